@@ -0,0 +1,329 @@
+#include <armadillo>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ClusterZI/zidm_chain.h"
+#include "zidm_args.h"
+#include "zidm_simulate.h"
+
+/* Benchmark of the sampler kernels, without R.
+ *
+ * Simulates a zero-inflated Dirichlet-multinomial table (see
+ * zidm_simulate.h), runs warmup iterations of ZIDM-ZIDM so that the chain
+ * has several active clusters, and then times every kernel separately on
+ * that state, reps times each: the batched log_marginal over all samples
+ * and active clusters, update_at_risk, update_beta (and the blocked update
+ * when beta_block > 0), realloc, realloc_blocked, one split-merge proposal
+ * and update_tau. Finally, it times sweeps full iterations of run_chain,
+ * with the profile of its steps (see zidm_profile.h).
+ * The results are written as JSON to out (or the standard output).
+ *
+ * Usage: zidm_bench [--name value]..., see bench_config for the names.
+ */
+
+struct bench_config {
+  
+  unsigned int n;
+  unsigned int p;
+  unsigned int K;           // clusters of the simulated data
+  unsigned int K_max;
+  double zero_prob;         // probability of a structural zero
+  double depth;             // mean sequencing depth
+  unsigned int reps;        // timed calls of every kernel
+  unsigned int warmup;      // iterations before the kernels are timed
+  unsigned int sweeps;      // timed full iterations
+  unsigned int threads;
+  unsigned int beta_block;
+  unsigned int launch_iter;
+  std::uint64_t seed;
+  std::string out;
+  
+  bench_config(): n(500), p(200), K(5), K_max(10), zero_prob(0.5),
+    depth(5000), reps(20), warmup(20), sweeps(50), threads(1),
+    beta_block(0), launch_iter(5), seed(1) {}
+  
+};
+
+struct bench_timing {
+  
+  std::string name;
+  unsigned int reps;
+  double mean_ms;
+  double min_ms;
+  double max_ms;
+  
+};
+
+template <typename F>
+bench_timing time_kernel(const std::string &name, unsigned int reps, F f){
+  
+  /* Time reps calls of f(r), r = 0, ..., reps - 1 */
+  
+  bench_timing result = {name, reps, 0.0, 0.0, 0.0};
+  for(unsigned int r = 0; r < reps; ++r){
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    f(r);
+    std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+    double ms = elapsed.count();
+    result.mean_ms += ms / reps;
+    result.min_ms = (r == 0) ? ms : std::min(result.min_ms, ms);
+    result.max_ms = (r == 0) ? ms : std::max(result.max_ms, ms);
+  }
+  return result;
+  
+}
+
+bool parse_args(int argc, char **argv, bench_config &config){
+  
+  /* --name value pairs; returns false on an unknown name, a missing value
+     or a value that is not one of its type (see zidm_args.h) */
+  
+  for(int a = 1; a < argc; a += 2){
+    std::string name = argv[a];
+    if((name.compare(0, 2, "--") != 0) or (a + 1 >= argc)){
+      return false;
+    }
+    name = name.substr(2);
+    const std::string value = argv[a + 1];
+    bool ok = false;
+    if(name == "n"){
+      ok = parse_value(value, config.n);
+    } else if(name == "p"){
+      ok = parse_value(value, config.p);
+    } else if(name == "K"){
+      ok = parse_value(value, config.K);
+    } else if(name == "K_max"){
+      ok = parse_value(value, config.K_max);
+    } else if(name == "zero_prob"){
+      ok = parse_value(value, config.zero_prob);
+    } else if(name == "depth"){
+      ok = parse_value(value, config.depth);
+    } else if(name == "reps"){
+      ok = parse_value(value, config.reps);
+    } else if(name == "warmup"){
+      ok = parse_value(value, config.warmup);
+    } else if(name == "sweeps"){
+      ok = parse_value(value, config.sweeps);
+    } else if(name == "threads"){
+      ok = parse_value(value, config.threads);
+    } else if(name == "beta_block"){
+      ok = parse_value(value, config.beta_block);
+    } else if(name == "launch_iter"){
+      ok = parse_value(value, config.launch_iter);
+    } else if(name == "seed"){
+      ok = parse_value(value, config.seed);
+    } else if(name == "out"){
+      ok = parse_value(value, config.out);
+    }
+    if(not ok){
+      return false;
+    }
+  }
+  return (config.n >= 2) and (config.p >= 1) and (config.K >= 1) and
+    (config.K_max >= 2) and (config.reps >= 1) and (config.threads >= 1);
+  
+}
+
+void write_json(std::ostream &os, const bench_config &config,
+                const zidm_data &data, unsigned int K_active,
+                const std::vector<bench_timing> &kernels, double sweep_ms,
+                const chain_profile &prof){
+  
+  /* The configuration, the data, the kernel timings (ms per call), the
+     mean time of a full iteration and the profile of its steps */
+  
+  double nnz = data.nz_col.size();
+  double mean_depth = 0.0;
+  for(unsigned int i = 0; i < data.n; ++i){
+    mean_depth += data.total[i] / data.n;
+  }
+  
+  os << "{\n";
+  os << "  \"config\": {\"n\": " << config.n << ", \"p\": " << config.p
+     << ", \"K\": " << config.K << ", \"K_max\": " << config.K_max
+     << ", \"zero_prob\": " << config.zero_prob << ", \"depth\": "
+     << config.depth << ", \"reps\": " << config.reps << ", \"warmup\": "
+     << config.warmup << ", \"sweeps\": " << config.sweeps
+     << ", \"threads\": " << config.threads << ", \"beta_block\": "
+     << config.beta_block << ", \"launch_iter\": " << config.launch_iter
+     << ", \"seed\": " << config.seed << "},\n";
+  os << "  \"build\": {\"openmp\": ";
+  #ifdef _OPENMP
+  os << "true";
+  #else
+  os << "false";
+  #endif
+  os << ", \"simd_clones\": ";
+  #if defined(CLUSTERZI_NO_SIMD)
+  os << "false";
+  #else
+  os << "true";
+  #endif
+  os << "},\n";
+  os << "  \"data\": {\"nonzero_fraction\": "
+     << nnz / ((double)data.n * data.p) << ", \"mean_depth\": " << mean_depth
+     << ", \"K_active\": " << K_active << "},\n";
+  os << "  \"kernels\": [\n";
+  for(std::size_t r = 0; r < kernels.size(); ++r){
+    os << "    {\"name\": \"" << kernels[r].name << "\", \"reps\": "
+       << kernels[r].reps << ", \"mean_ms\": " << kernels[r].mean_ms
+       << ", \"min_ms\": " << kernels[r].min_ms << ", \"max_ms\": "
+       << kernels[r].max_ms << "}" << (r + 1 < kernels.size() ? "," : "")
+       << "\n";
+  }
+  os << "  ],\n";
+  os << "  \"sweep\": {\"name\": \"ZIDM_ZIDM\", \"iterations\": "
+     << config.sweeps << ", \"mean_ms\": " << sweep_ms << "},\n";
+  os << "  \"profile\": [\n";
+  for(int s = 0; s < n_prof_steps; ++s){
+    os << "    {\"step\": \"" << profile_names[s] << "\", \"calls\": "
+       << prof.calls[s] << ", \"seconds\": " << prof.seconds[s]
+       << ", \"proposed\": " << prof.proposed[s] << ", \"accepted\": "
+       << prof.accepted[s] << "}" << (s + 1 < n_prof_steps ? "," : "")
+       << "\n";
+  }
+  os << "  ]\n";
+  os << "}\n";
+  
+}
+
+void zero_empty(const arma::vec &nk, arma::vec &tau_vec){
+  for(unsigned int k = 0; k < nk.n_elem; ++k){
+    if(nk[k] == 0){
+      tau_vec[k] = 0.0;
+    }
+  }
+}
+
+int main(int argc, char **argv){
+  
+  bench_config config;
+  if(not parse_args(argc, argv, config)){
+    std::cerr << "usage: zidm_bench [--n 500] [--p 200] [--K 5] [--K_max 10] "
+              << "[--zero_prob 0.5] [--depth 5000] [--reps 20] [--warmup 20] "
+              << "[--sweeps 50] [--threads 1] [--beta_block 0] "
+              << "[--launch_iter 5] [--seed 1] [--out file.json]" << std::endl;
+    return 1;
+  }
+  
+  // Data and hyperparameters (those of application/microbiome.R)
+  zidm_sim sim = simulate_zidm(config.n, config.p, config.K, config.zero_prob,
+                               config.depth, config.seed);
+  zidm_data data(&sim.z[0], config.n, config.p);
+  const unsigned int K_max = config.K_max;
+  arma::vec theta_vec(K_max);
+  theta_vec.fill(1.0);
+  const double mu = 0.0, s2 = 1.0, MH_var = 1.0;
+  const double r0g = 1.0, r1g = 1.0, r0c = 1.0, r1c = 1.0;
+  zidm_param param = {K_max, theta_vec, config.launch_iter, MH_var, mu, s2,
+                      true, r0g, r1g, r0c, r1c, false, 1, sm_fixed, 1, false,
+                      config.beta_block, false, false};
+  
+  // Warmup
+  rng_key key(config.seed);
+  chain_state state;
+  init_state(state, data, param, key);
+  trace_select sel(0, 1, 0);
+  chain_trace trace;
+  run_chain(trace, state, config.warmup, data, param, sel, key,
+            config.threads, 0, false, NULL);
+  
+  // Kernels, from the state after the warmup
+  clus_cache cache = make_cache(state.beta, data);
+  sampler_work work(data.n, data.p, K_max);
+  beta_blocks blk(data, K_max, config.beta_block > 0 ? config.beta_block :
+                    data.p);
+  work.count(state.assign);
+  const unsigned int K_active = work.n_active;
+  const std::uint64_t t0 = state.iter;
+  std::vector<bench_timing> kernels;
+  
+  std::vector<double> out(K_max), buf(2 * K_max);
+  kernels.push_back(time_kernel("log_marginal", config.reps,
+                                [&](unsigned int /*r*/){
+    work.count(state.assign);
+    for(unsigned int i = 0; i < data.n; ++i){
+      log_marginal(data, i, state.gamma, cache, &work.active[0], work.n_active,
+                   &out[0], &buf[0]);
+    }
+  }));
+  
+  kernels.push_back(time_kernel("update_at_risk", config.reps,
+                                [&](unsigned int r){
+    update_at_risk(data, state.assign, state.gamma, cache, r0g, r1g, key,
+                   t0 + r, config.threads);
+  }));
+  
+  kernels.push_back(time_kernel("update_beta", config.reps,
+                                [&](unsigned int r){
+    update_beta(data, state.assign, state.gamma, state.beta, cache, mu, s2,
+                state.mh, false, key, t0 + r, work);
+  }));
+  
+  if(config.beta_block > 0){
+    kernels.push_back(time_kernel("update_beta_blocked", config.reps,
+                                  [&](unsigned int r){
+      update_beta_blocked(data, state.assign, state.gamma, state.beta, cache,
+                          mu, s2, state.mh, false, key, t0 + r, work, blk);
+    }));
+  }
+  
+  // The reallocations leave tau at 0 for the emptied clusters, as run_chain
+  kernels.push_back(time_kernel("realloc", config.reps, [&](unsigned int r){
+    realloc(data, state.assign, state.gamma, cache, theta_vec, key, t0 + r,
+            work);
+    zero_empty(work.nk, state.tau);
+  }));
+  
+  kernels.push_back(time_kernel("realloc_blocked", config.reps,
+                                [&](unsigned int r){
+    realloc_blocked(data, state.assign, state.gamma, cache, state.tau, key,
+                    t0 + r, config.threads, work);
+    zero_empty(work.nk, state.tau);
+  }));
+  
+  kernels.push_back(time_kernel("sm", config.reps, [&](unsigned int r){
+    rng_stream rng_sm(key, t0 + r, step_sm);
+    sm(K_max, data, state.assign, state.gamma, state.beta, cache, state.tau,
+       theta_vec, config.launch_iter, mu, s2, r0c, r1c, rng_sm, config.threads,
+       work);
+  }));
+  
+  kernels.push_back(time_kernel("update_tau", config.reps, [&](unsigned int r){
+    update_tau(state.assign, state.tau, theta_vec, state.U, key, t0 + r, work);
+  }));
+  
+  // Full iterations, from the state after the warmup
+  param.profile = true;
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  run_chain(trace, state, config.sweeps, data, param, sel, key,
+            config.threads, 0, false, NULL);
+  std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+  double sweep_ms = (config.sweeps > 0) ? elapsed.count() / config.sweeps : 0.0;
+  
+  // Result
+  if(config.out.empty()){
+    write_json(std::cout, config, data, K_active, kernels, sweep_ms,
+               trace.profile);
+  } else {
+    std::ofstream os(config.out.c_str());
+    write_json(os, config, data, K_active, kernels, sweep_ms, trace.profile);
+    if(not os){
+      std::cerr << "zidm_bench: cannot write " << config.out << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+  
+}
@@ -0,0 +1,96 @@
+#ifndef CLUSTERZI_ZIDM_SIMULATE_H
+#define CLUSTERZI_ZIDM_SIMULATE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ClusterZI/zidm_rng.h"
+
+/* Synthetic zero-inflated Dirichlet-multinomial counts.
+ *
+ * Sample i belongs to one of K clusters, drawn uniformly. Cluster k has
+ * beta_kj ~ N(0, beta_sd^2) and xi_kj = exp(beta_kj). Each taxon of a
+ * sample is at risk with probability 1 - zero_prob (at least one taxon
+ * is), and the taxa that are not at risk have a structural zero. The
+ * multinomial probabilities of the sample are Dirichlet(xi_k) over its
+ * at-risk taxa. The depth is log-normal with mean depth and a log-scale sd
+ * of 0.5. Every sample draws from its own stream, so the table only
+ * depends on the seed and the sizes.
+ */
+
+struct zidm_sim {
+
+  unsigned int n;
+  unsigned int p;
+  unsigned int K;
+  std::vector<double> z;                 // n x p counts, column-major
+  std::vector<unsigned int> assign;      // true clusters
+  std::vector<unsigned char> at_risk;    // n x p, column-major
+  std::vector<double> beta;              // K x p, column-major
+
+};
+
+inline zidm_sim simulate_zidm(unsigned int n, unsigned int p, unsigned int K,
+                              double zero_prob, double depth,
+                              std::uint64_t seed, double beta_sd = 1.0){
+
+  zidm_sim sim;
+  sim.n = n;
+  sim.p = p;
+  sim.K = K;
+  sim.z.assign(static_cast<std::size_t>(n) * p, 0.0);
+  sim.assign.resize(n);
+  sim.at_risk.assign(static_cast<std::size_t>(n) * p, 0);
+  sim.beta.resize(static_cast<std::size_t>(K) * p);
+
+  rng_key key(seed);
+  rng_stream rng(key, 0, step_init);
+  for(std::size_t e = 0; e < sim.beta.size(); ++e){
+    sim.beta[e] = beta_sd * rng.norm();
+  }
+
+  std::vector<double> prob(p);
+  for(unsigned int i = 0; i < n; ++i){
+    rng_stream rng_i(key, 0, step_init, i + 1);
+    unsigned int k = rng_i.index(K);
+    sim.assign[i] = k;
+
+    // At-risk taxa and their Dirichlet probabilities (cumulated)
+    unsigned int n_risk = 0;
+    double total = 0.0;
+    for(unsigned int j = 0; j < p; ++j){
+      bool risk = rng_i.unif() >= zero_prob;
+      if((j == p - 1) and (n_risk == 0)){
+        risk = true;
+      }
+      double w = 0.0;
+      if(risk){
+        n_risk += 1;
+        sim.at_risk[i + static_cast<std::size_t>(j) * n] = 1;
+        double xi = std::exp(sim.beta[k + static_cast<std::size_t>(j) * K]);
+        w = std::max(rng_i.gamma(xi, 1.0), 1e-300);
+      }
+      total += w;
+      prob[j] = total;
+    }
+
+    // Multinomial counts; a draw picks the taxon of its cumulated weight
+    double d = depth * std::exp(0.5 * rng_i.norm() - 0.125);
+    unsigned int depth_i = std::max(1.0, std::floor(d + 0.5));
+    for(unsigned int r = 0; r < depth_i; ++r){
+      double u = rng_i.unif() * total;
+      unsigned int j = std::upper_bound(prob.begin(), prob.end(), u) -
+        prob.begin();
+      j = std::min(j, p - 1);
+      sim.z[i + static_cast<std::size_t>(j) * n] += 1;
+    }
+  }
+
+  return sim;
+
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef CLUSTERZI_ZIDM_ARGS_H
+#define CLUSTERZI_ZIDM_ARGS_H
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+/* Parsing of the option values of the programs without R (zidm_run and
+ * zidm_bench). A value is valid when all of its text is read; unsigned
+ * options also refuse a leading '-', which >> would wrap around. */
+
+template <typename T>
+bool parse_value(const std::string &text, T &value){
+  std::istringstream in(text);
+  in >> value;
+  return (not in.fail()) and (in >> std::ws).eof();
+}
+
+template <typename T>
+bool parse_unsigned(const std::string &text, T &value){
+  std::string::size_type first = text.find_first_not_of(" \t");
+  if((first != std::string::npos) and (text[first] == '-')){
+    return false;
+  }
+  std::istringstream in(text);
+  in >> value;
+  return (not in.fail()) and (in >> std::ws).eof();
+}
+
+inline bool parse_value(const std::string &text, unsigned int &value){
+  return parse_unsigned(text, value);
+}
+
+inline bool parse_value(const std::string &text, std::uint64_t &value){
+  return parse_unsigned(text, value);
+}
+
+inline bool parse_value(const std::string &text, std::string &value){
+  value = text;
+  return true;
+}
+
+inline bool parse_value(const std::string &text, bool &value){
+  if(text == "true" or text == "TRUE" or text == "yes" or text == "1"){
+    value = true;
+  } else if(text == "false" or text == "FALSE" or text == "no" or
+              text == "0"){
+    value = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,431 @@
+#include <armadillo>
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ClusterZI/zidm_api.h"
+#include "ClusterZI/zidm_table.h"
+#include "zidm_args.h"
+
+/* Batch runner of the samplers, without R.
+ *
+ * Reads a count table (CSV, TSV or the binary format of zidm_table.h),
+ * drops the taxa below min_prevalence, runs ZIDM_ZIDM, DM_ZIDM or DM_DM
+ * and streams the traces to out (read them in R with read_trace). The
+ * names of the kept taxa and of the samples go to out.taxa and
+ * out.samples, one per line (1-based indices in the file without names).
+ * With psm = true, the posterior similarity matrix of the kept iterations
+ * goes to out.psm (see write_psm_bin) and, unless point_loss = none, the
+ * point estimate of the labels to out.point, one 0-based label per sample
+ * as in the assign trace; traces can then leave out assign.
+ *
+ * The options come from a config file of "name = value" lines (# starts a
+ * comment) and from the command line, which overrides it:
+ *
+ *   zidm_run --config run.conf [--name value]...
+ *
+ * See run_config for the names and their defaults. Any seed, 0 included,
+ * gives a reproducible run; without seed, the seed is random, and the
+ * summary prints it. With resume = true, a ZIDM_ZIDM or DM_ZIDM chain
+ * continues from checkpoint instead: the trace file out is cut back to the
+ * checkpoint and continued (see trace_writer), and out.taxa and
+ * out.samples are kept.
+ */
+
+struct run_config {
+  
+  std::string model;
+  std::string input;
+  table_format fmt;
+  std::string out;
+  std::string save_bin;     // write the filtered table there
+  unsigned int iter;
+  unsigned int burn_in;
+  unsigned int thin;
+  std::string traces;       // comma-separated trace names
+  bool compress;
+  unsigned int K_max;
+  double theta;             // theta_vec = theta, K_max times
+  unsigned int launch_iter;
+  double MH_var;
+  double mu;
+  double s2;
+  double r0g;
+  double r1g;
+  double r0c;
+  double r1c;
+  std::string realloc_mode;
+  unsigned int sm_attempts;
+  std::string sm_schedule;
+  unsigned int sm_every;
+  bool MH_adapt;
+  unsigned int beta_block;
+  unsigned int threads;
+  std::uint64_t seed;       // used when seed_set
+  bool seed_set;            // seed was given; a random seed otherwise
+  int print_iter;
+  std::string checkpoint;
+  unsigned int checkpoint_every;
+  bool resume;
+  bool profile;
+  bool psm;
+  std::string point_loss;   // binder, VI or none
+  
+  run_config(): model("ZIDM_ZIDM"), iter(1000), burn_in(0), thin(1),
+    traces("assign"), compress(true), K_max(10), theta(1.0), launch_iter(5),
+    MH_var(1.0), mu(0.0), s2(1.0), r0g(1.0), r1g(1.0), r0c(1.0), r1c(1.0),
+    realloc_mode("sequential"), sm_attempts(1), sm_schedule("fixed"),
+    sm_every(1), MH_adapt(false), beta_block(0), threads(1), seed(0),
+    seed_set(false), print_iter(0), checkpoint_every(0), resume(false), profile(false),
+    psm(false), point_loss("VI") {}
+  
+};
+
+void set_option(run_config &config, const std::string &name,
+                const std::string &value){
+  
+  /* Set option name from its text value; throws on an unknown name or a
+     bad value */
+  
+  bool ok = false;
+  if(name == "model"){
+    ok = parse_value(value, config.model);
+  } else if(name == "input"){
+    ok = parse_value(value, config.input);
+  } else if(name == "format"){
+    ok = parse_value(value, config.fmt.format);
+  } else if(name == "header"){
+    ok = parse_value(value, config.fmt.header);
+  } else if(name == "row_names"){
+    ok = parse_value(value, config.fmt.row_names);
+  } else if(name == "taxa_rows"){
+    ok = parse_value(value, config.fmt.taxa_rows);
+  } else if(name == "min_prevalence"){
+    ok = parse_value(value, config.fmt.min_prevalence);
+  } else if(name == "out"){
+    ok = parse_value(value, config.out);
+  } else if(name == "save_bin"){
+    ok = parse_value(value, config.save_bin);
+  } else if(name == "iter"){
+    ok = parse_value(value, config.iter);
+  } else if(name == "burn_in"){
+    ok = parse_value(value, config.burn_in);
+  } else if(name == "thin"){
+    ok = parse_value(value, config.thin);
+  } else if(name == "traces"){
+    ok = parse_value(value, config.traces);
+  } else if(name == "compress"){
+    ok = parse_value(value, config.compress);
+  } else if(name == "K_max"){
+    ok = parse_value(value, config.K_max);
+  } else if(name == "theta"){
+    ok = parse_value(value, config.theta);
+  } else if(name == "launch_iter"){
+    ok = parse_value(value, config.launch_iter);
+  } else if(name == "MH_var"){
+    ok = parse_value(value, config.MH_var);
+  } else if(name == "mu"){
+    ok = parse_value(value, config.mu);
+  } else if(name == "s2"){
+    ok = parse_value(value, config.s2);
+  } else if(name == "r0g"){
+    ok = parse_value(value, config.r0g);
+  } else if(name == "r1g"){
+    ok = parse_value(value, config.r1g);
+  } else if(name == "r0c"){
+    ok = parse_value(value, config.r0c);
+  } else if(name == "r1c"){
+    ok = parse_value(value, config.r1c);
+  } else if(name == "realloc_mode"){
+    ok = parse_value(value, config.realloc_mode);
+  } else if(name == "sm_attempts"){
+    ok = parse_value(value, config.sm_attempts);
+  } else if(name == "sm_schedule"){
+    ok = parse_value(value, config.sm_schedule);
+  } else if(name == "sm_every"){
+    ok = parse_value(value, config.sm_every);
+  } else if(name == "MH_adapt"){
+    ok = parse_value(value, config.MH_adapt);
+  } else if(name == "beta_block"){
+    ok = parse_value(value, config.beta_block);
+  } else if(name == "threads"){
+    ok = parse_value(value, config.threads);
+  } else if(name == "seed"){
+    ok = parse_value(value, config.seed);
+    config.seed_set = true;
+  } else if(name == "print_iter"){
+    ok = parse_value(value, config.print_iter);
+  } else if(name == "checkpoint"){
+    ok = parse_value(value, config.checkpoint);
+  } else if(name == "checkpoint_every"){
+    ok = parse_value(value, config.checkpoint_every);
+  } else if(name == "resume"){
+    ok = parse_value(value, config.resume);
+  } else if(name == "profile"){
+    ok = parse_value(value, config.profile);
+  } else if(name == "psm"){
+    ok = parse_value(value, config.psm);
+  } else if(name == "point_loss"){
+    ok = parse_value(value, config.point_loss);
+  } else {
+    throw std::invalid_argument("unknown option \"" + name + "\".");
+  }
+  if(not ok){
+    throw std::invalid_argument("bad value \"" + value + "\" of " + name +
+                                ".");
+  }
+  
+}
+
+std::string trim(const std::string &text){
+  std::string::size_type begin = text.find_first_not_of(" \t\r");
+  if(begin == std::string::npos){
+    return "";
+  }
+  std::string::size_type end = text.find_last_not_of(" \t\r");
+  return text.substr(begin, end - begin + 1);
+}
+
+void read_config(const std::string &path, run_config &config){
+  
+  /* "name = value" lines; # starts a comment */
+  
+  std::ifstream in(path.c_str());
+  if(not in){
+    throw std::runtime_error("cannot open " + path);
+  }
+  std::string line;
+  unsigned int line_no = 0;
+  while(std::getline(in, line)){
+    line_no += 1;
+    line = trim(line.substr(0, line.find('#')));
+    if(line.empty()){
+      continue;
+    }
+    std::string::size_type eq = line.find('=');
+    if(eq == std::string::npos){
+      std::ostringstream msg;
+      msg << path << ", line " << line_no << ": expected name = value.";
+      throw std::invalid_argument(msg.str());
+    }
+    set_option(config, trim(line.substr(0, eq)), trim(line.substr(eq + 1)));
+  }
+  
+}
+
+void parse_args(int argc, char **argv, run_config &config){
+  
+  /* --name value pairs, after the file of --config when there is one */
+  
+  std::vector<std::string> names, values;
+  for(int a = 1; a < argc; a += 2){
+    std::string name = argv[a];
+    if((name.compare(0, 2, "--") != 0) or (a + 1 >= argc)){
+      throw std::invalid_argument("expected --name value, got \"" + name +
+                                  "\".");
+    }
+    if(name == "--config"){
+      read_config(argv[a + 1], config);
+    } else {
+      names.push_back(name.substr(2));
+      values.push_back(argv[a + 1]);
+    }
+  }
+  for(std::size_t o = 0; o < names.size(); ++o){
+    set_option(config, names[o], values[o]);
+  }
+  
+}
+
+unsigned int trace_mask(const std::string &traces){
+  
+  /* Bit mask of the comma-separated trace names */
+  
+  unsigned int mask = 0;
+  std::istringstream in(traces);
+  std::string name;
+  while(std::getline(in, name, ',')){
+    name = trim(name);
+    int id = trace_from_name(name);
+    if(id < 0){
+      throw std::invalid_argument("unknown trace \"" + name + "\".");
+    }
+    mask |= 1u << id;
+  }
+  return mask;
+  
+}
+
+bool file_exists(const std::string &path){
+  std::ifstream in(path.c_str());
+  return in.good();
+}
+
+void write_names(const std::string &path, const std::vector<std::string> &names,
+                 const std::vector<unsigned int> &index){
+  
+  /* names, one per line, or the 1-based index when there are none */
+  
+  std::ofstream os(path.c_str());
+  for(std::size_t r = 0; r < index.size(); ++r){
+    if(names.empty()){
+      os << index[r] + 1 << "\n";
+    } else {
+      os << names[r] << "\n";
+    }
+  }
+  if(not os){
+    throw std::runtime_error("cannot write " + path);
+  }
+  
+}
+
+void write_profile(std::ostream &os, const chain_profile &prof){
+  os << "step\tcalls\tseconds\tproposed\taccepted\n";
+  for(int s = 0; s < n_prof_steps; ++s){
+    os << profile_names[s] << "\t" << prof.calls[s] << "\t" << prof.seconds[s]
+       << "\t" << prof.proposed[s] << "\t" << prof.accepted[s] << "\n";
+  }
+}
+
+int run_job(const run_config &config){
+  
+  if(config.input.empty() or config.out.empty()){
+    throw std::invalid_argument("input and out must be given.");
+  }
+  bool dm_dm = (config.model == "DM_DM");
+  if((config.model != "ZIDM_ZIDM") and (config.model != "DM_ZIDM") and
+       (not dm_dm)){
+    throw std::invalid_argument(
+      "model must be ZIDM_ZIDM, DM_ZIDM or DM_DM.");
+  }
+  if(config.resume and (dm_dm or config.checkpoint.empty())){
+    throw std::invalid_argument(
+      "resume needs a checkpoint of ZIDM_ZIDM or DM_ZIDM.");
+  }
+  if(config.threads == 0){
+    throw std::invalid_argument("threads must be a positive integer.");
+  }
+  // A split needs room for a second cluster; DM_DM has K_max clusters
+  if((not dm_dm) and (config.K_max < 2)){
+    throw std::invalid_argument("K_max must be at least 2.");
+  }
+  if(config.K_max == 0){
+    throw std::invalid_argument("K_max must be a positive integer.");
+  }
+  
+  // Data
+  count_table table = read_counts(config.input, config.fmt);
+  if(table.z.n_cols == 0){
+    throw std::runtime_error("no taxon passes min_prevalence.");
+  }
+  if(not config.save_bin.empty()){
+    write_count_bin(config.save_bin, table.z);
+  }
+  std::vector<unsigned int> rows(table.z.n_rows);
+  for(unsigned int i = 0; i < table.z.n_rows; ++i){
+    rows[i] = i;
+  }
+  // A resumed run keeps the names of the run it continues
+  if((not config.resume) or (not file_exists(config.out + ".taxa"))){
+    write_names(config.out + ".taxa", table.taxa, table.keep);
+  }
+  if((not config.resume) or (not file_exists(config.out + ".samples"))){
+    write_names(config.out + ".samples", table.samples, rows);
+  }
+  
+  // Parameters
+  arma::vec theta_vec(config.K_max);
+  theta_vec.fill(config.theta);
+  zidm_param param = {config.K_max, theta_vec, config.launch_iter,
+                      config.MH_var, config.mu, config.s2,
+                      config.model == "ZIDM_ZIDM", config.r0g, config.r1g,
+                      config.r0c, config.r1c,
+                      blocked_realloc(config.realloc_mode),
+                      config.sm_attempts,
+                      sm_plan_type(config.sm_schedule, config.sm_attempts,
+                                   config.sm_every),
+                      config.sm_every, config.MH_adapt, config.beta_block,
+                      config.profile, config.psm};
+  zidm_options opt;
+  opt.iter = config.iter;
+  opt.sel = trace_select(config.burn_in, config.thin,
+                         trace_mask(config.traces));
+  opt.n_threads = config.threads;
+  opt.print_iter = config.print_iter;
+  opt.out_file = config.out;
+  opt.compress = config.compress;
+  opt.checkpoint_file = config.checkpoint;
+  opt.checkpoint_every = config.checkpoint_every;
+  opt.point_loss = point_loss_type(config.point_loss);
+  std::uint64_t seed = config.seed;
+  if(not config.seed_set){
+    std::random_device device;
+    seed = (static_cast<std::uint64_t>(device()) << 32) | device();
+  }
+  
+  // Run
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  zidm_run run;
+  if(dm_dm){
+    run = zidm_fit_dm(table.z, param, opt, rng_key(seed));
+  } else if(config.resume){
+    run = zidm_resume(config.checkpoint, table.z, param, opt);
+  } else {
+    run = zidm_fit(table.z, param, opt, rng_key(seed));
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  
+  // Summary
+  std::cout << "model: " << config.model << "\nn: " << table.z.n_rows
+            << "\np: " << table.z.n_cols << " of " << table.p_file
+            << "\nseed: " << run.key.seed << "\niterations: "
+            << run.state.iter << "\nseconds: " << elapsed.count()
+            << "\nout: " << config.out << std::endl;
+  if(config.profile and (not dm_dm)){
+    write_profile(std::cerr, run.trace.profile);
+  }
+  if(config.psm){
+    write_psm_bin(config.out + ".psm", run.trace.psm);
+  }
+  if(not run.point.empty()){
+    std::ofstream os((config.out + ".point").c_str());
+    for(std::size_t i = 0; i < run.point.size(); ++i){
+      os << run.point[i] << "\n";
+    }
+    if(not os){
+      throw std::runtime_error("cannot write " + config.out + ".point");
+    }
+  }
+  return 0;
+  
+}
+
+int main(int argc, char **argv){
+  
+  run_config config;
+  try {
+    parse_args(argc, argv, config);
+  } catch(const std::exception &e){
+    std::cerr << "zidm_run: " << e.what() << "\n"
+              << "usage: zidm_run [--config file] [--name value]...\n"
+              << "a run without --seed draws a random seed" << std::endl;
+    return 1;
+  }
+  try {
+    return run_job(config);
+  } catch(const std::exception &e){
+    std::cerr << "zidm_run: " << e.what() << std::endl;
+    return 1;
+  }
+  
+}
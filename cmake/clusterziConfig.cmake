@@ -0,0 +1,6 @@
+# find_package(clusterzi): the installed clusterzi::clusterzi target and its
+# dependencies
+include(CMakeFindDependencyMacro)
+find_dependency(Armadillo)
+find_package(OpenMP)
+include("${CMAKE_CURRENT_LIST_DIR}/clusterziTargets.cmake")
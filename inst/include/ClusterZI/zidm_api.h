@@ -0,0 +1,273 @@
+#ifndef CLUSTERZI_ZIDM_API_H
+#define CLUSTERZI_ZIDM_API_H
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <armadillo>
+
+#include "zidm_chain.h"
+#include "zidm_psm.h"
+
+/* C++ interface of the samplers, without R.
+ *
+ * zidm_fit() runs a new DM-ZIDM (param.at_risk = false) or ZIDM-ZIDM chain
+ * on an n x p count matrix, zidm_fit_dm() a DM-DM chain, zidm_resume()
+ * continues a DM-ZIDM or ZIDM-ZIDM chain from its checkpoint file, and
+ * zidm_predict() gives the cluster probabilities of new samples given the
+ * state of a chain. The R functions DM_ZIDM, ZIDM_ZIDM, DM_DM and
+ * ZIDM_ZIDM_resume are wrappers of the first three. Invalid
+ * arguments throw std::invalid_argument, and unreadable or mismatched
+ * files std::runtime_error.
+ *
+ * With param.psm, the posterior similarity matrix of the kept iterations is
+ * accumulated in run.trace.psm, and with opt.point_loss, run.point is the
+ * point estimate of the clustering from it (see zidm_psm.h); the assign
+ * trace can then be left out of opt.sel.
+ *
+ *   zidm_param param = {K_max, theta_vec, launch_iter, MH_var, mu, s2, true,
+ *                       r0g, r1g, r0c, r1c, false, 1, sm_fixed, 1, false, 0,
+ *                       false, false};
+ *   zidm_options opt;
+ *   opt.iter = 1000;
+ *   opt.sel = trace_select(500, 1);
+ *   zidm_run run = zidm_fit(z, param, opt, rng_key(seed));
+ *   arma::mat prob = zidm_predict(run.state, z_new, param, 50, run.key);
+ */
+
+struct zidm_options {
+
+  unsigned int iter;
+  trace_select sel;             // kept iterations and traces
+  unsigned int n_threads;
+  int print_iter;               // print every print_iter iterations, 0 never
+  bool record_loglik;
+  std::string out_file;         // stream the traces there, not to memory
+  bool compress;
+  std::string checkpoint_file;  // save the state there, see run_chain()
+  unsigned int checkpoint_every;
+  int point_loss;               // see point_loss_type(), with param.psm
+
+  zidm_options(): iter(0), n_threads(1), print_iter(0), record_loglik(false),
+    compress(true), checkpoint_every(0), point_loss(loss_none) {}
+
+};
+
+struct zidm_run {
+
+  /* The last state of a chain, its stream key and its traces */
+
+  chain_state state;
+  rng_key key;
+  chain_trace trace;
+  std::vector<unsigned int> point;   // point estimate, or empty
+
+};
+
+inline void zidm_point(zidm_run &run, const zidm_param &param,
+                       const zidm_options &opt){
+
+  /* The point estimate of the clustering, if requested, from the PSM of the
+   * run and started at its last labels */
+
+  run.point.clear();
+  if(param.psm and (opt.point_loss != loss_none) and
+       (run.trace.psm.n_draws > 0)){
+    run.point = psm_point(run.trace.psm, opt.point_loss, param.K_max,
+                          run.state.assign);
+  }
+
+}
+
+inline void zidm_run_chain(zidm_run &run, const zidm_data &data,
+                           const zidm_param &param, const zidm_options &opt){
+
+  /* Run opt.iter iterations from run.state, to memory or to opt.out_file.
+   * A new chain replaces opt.out_file; a resumed one continues it from the
+   * position of its checkpoint (see trace_writer). */
+
+  if(opt.sel.thin == 0){
+    throw std::invalid_argument("thin must be a positive integer.");
+  }
+  check_threads(opt.n_threads);
+  if(opt.out_file.empty()){
+    run_chain(run.trace, run.state, opt.iter, data, param, opt.sel, run.key,
+              opt.n_threads, opt.print_iter, opt.record_loglik, NULL,
+              opt.checkpoint_file, opt.checkpoint_every);
+  } else {
+    trace_dims dims = make_dims(data, param.K_max);
+    std::unique_ptr<trace_writer> sink((run.state.iter == 0) ?
+      new trace_writer(opt.out_file, dims, opt.sel.mask, opt.compress) :
+      new trace_writer(opt.out_file, dims, opt.sel.mask, opt.compress,
+                       run.state.trace_pos));
+    run_chain(run.trace, run.state, opt.iter, data, param, opt.sel, run.key,
+              opt.n_threads, opt.print_iter, opt.record_loglik, sink.get(),
+              opt.checkpoint_file, opt.checkpoint_every);
+    sink->close();
+  }
+  zidm_point(run, param, opt);
+
+}
+
+inline zidm_run zidm_fit(const arma::mat &z, const zidm_param &param,
+                         const zidm_options &opt, const rng_key &key){
+
+  /* New chain on the n x p counts z, drawing from the streams of key */
+
+  if(param.theta_vec.n_elem < param.K_max){
+    throw std::invalid_argument(
+      "theta_vec must have at least K_max elements.");
+  }
+  zidm_data data = make_data(z);
+  zidm_run run;
+  run.key = key;
+  init_state(run.state, data, param, key);
+  zidm_run_chain(run, data, param, opt);
+  return run;
+
+}
+
+inline zidm_run zidm_fit_dm(const arma::mat &z, const zidm_param &param,
+                            const zidm_options &opt, const rng_key &key){
+
+  /* New DM-DM chain on the n x p counts z (see run_dm_chain). Only the
+   * assign and beta traces of opt.sel are recorded; opt.n_threads,
+   * opt.record_loglik and the checkpoint are not used. */
+
+  if(param.theta_vec.n_elem < param.K_max){
+    throw std::invalid_argument(
+      "theta_vec must have at least K_max elements.");
+  }
+  if(opt.sel.thin == 0){
+    throw std::invalid_argument("thin must be a positive integer.");
+  }
+  trace_select sel = opt.sel;
+  sel.mask &= (1u << trace_assign) | (1u << trace_beta);
+  zidm_data data = make_data(z);
+  zidm_run run;
+  run.key = key;
+  init_state(run.state, data, param, key);
+  if(opt.out_file.empty()){
+    run_dm_chain(run.trace, run.state, opt.iter, data, param, sel, run.key,
+                 opt.print_iter, NULL);
+  } else {
+    trace_writer sink(opt.out_file, make_dims(data, param.K_max), sel.mask,
+                      opt.compress);
+    run_dm_chain(run.trace, run.state, opt.iter, data, param, sel, run.key,
+                 opt.print_iter, &sink);
+    sink.close();
+  }
+  zidm_point(run, param, opt);
+  return run;
+
+}
+
+inline zidm_run zidm_resume(const std::string &checkpoint_file,
+                            const arma::mat &z, const zidm_param &param,
+                            const zidm_options &opt){
+
+  /* Continue the chain saved in checkpoint_file, on the same counts z and
+   * with its key, so that the draws are those of an uninterrupted run (see
+   * ZIDM_ZIDM_resume). The model of the chain must be that of param, and
+   * opt.sel that of the original run. opt.out_file continues the trace
+   * file of the run when it is the same file. */
+
+  zidm_data data = make_data(z);
+  zidm_run run;
+  bool at_risk = true;
+  load_state(checkpoint_file, data, param, run.state, run.key, at_risk);
+  if(param.K_max != run.state.beta.n_rows){
+    throw std::invalid_argument(
+      "theta_vec does not match K_max of the checkpoint.");
+  }
+  if(at_risk != param.at_risk){
+    throw std::runtime_error(checkpoint_file + " was not written by " +
+                             (param.at_risk ? "ZIDM_ZIDM." : "DM_ZIDM."));
+  }
+  zidm_run_chain(run, data, param, opt);
+  return run;
+
+}
+
+inline arma::mat zidm_predict(const chain_state &state, const arma::mat &z,
+                              const zidm_param &param, unsigned int sweeps,
+                              const rng_key &key, unsigned int n_threads = 1){
+
+  /* n x K_max matrix of the probabilities that the new samples (rows of z)
+   * belong to each cluster, given beta and tau of state. Given them, the
+   * samples are independent: with param.at_risk, every sample runs its own
+   * Gibbs sampler of its label and at-risk indicators for sweeps sweeps,
+   * and the result averages the conditional label probabilities over the
+   * second half of the sweeps. Without it, one sweep gives the exact
+   * probabilities. Each sample draws from its own stream, so the result
+   * does not depend on n_threads. */
+
+  const unsigned int K_max = state.beta.n_rows;
+  zidm_data data = make_data(z);
+  if(data.p != state.beta.n_cols){
+    throw std::invalid_argument("z does not have the taxa of the chain.");
+  }
+  if(sweeps == 0){
+    throw std::invalid_argument("sweeps must be a positive integer.");
+  }
+  check_threads(n_threads);
+
+  // Active clusters, those with tau_k > 0, and their log weights
+  std::vector<unsigned int> active;
+  std::vector<double> log_tau;
+  for(unsigned int k = 0; k < K_max; ++k){
+    if(state.tau[k] > 0){
+      active.push_back(k);
+      log_tau.push_back(std::log(state.tau[k]));
+    }
+  }
+  const unsigned int K_pos = active.size();
+  if(K_pos == 0){
+    throw std::invalid_argument("state has no active cluster.");
+  }
+
+  clus_cache cache = make_cache(state.beta, data);
+  at_risk_vec gamma(data.n_zero(), 1);
+  const unsigned int n_sweeps = param.at_risk ? sweeps : 1;
+  const unsigned int n_burn = n_sweeps / 2;
+  double lb[2] = {log_beta(param.r0g, param.r1g + 1),
+                  log_beta(param.r0g + 1, param.r1g)};
+
+  arma::mat prob(data.n, K_max, arma::fill::zeros);
+  const int n = data.n;
+
+  #pragma omp parallel num_threads(n_threads)
+  {
+    // The weights and the lgamma buffer of this thread
+    std::vector<double> buf(3 * K_pos);
+    double *w = &buf[0];
+
+    #pragma omp for schedule(dynamic, 16)
+    for(int i = 0; i < n; ++i){
+      rng_stream rng(key, state.iter, step_predict, i);
+      for(unsigned int s = 0; s < n_sweeps; ++s){
+        log_marginal(data, i, gamma, cache, &active[0], K_pos, w, w + K_pos);
+        for(unsigned int kk = 0; kk < K_pos; ++kk){
+          w[kk] += log_tau[kk];
+        }
+        double total = exp_weights(w, K_pos);
+        if(s >= n_burn){
+          for(unsigned int kk = 0; kk < K_pos; ++kk){
+            prob(i, active[kk]) += w[kk] / total / (n_sweeps - n_burn);
+          }
+        }
+        if(s + 1 < n_sweeps){
+          unsigned int k = active[rng.categorical(w, K_pos, total)];
+          update_at_risk_row(data, i, gamma, cache[k], lb, rng);
+        }
+      }
+    }
+  }
+
+  return prob;
+
+}
+
+#endif
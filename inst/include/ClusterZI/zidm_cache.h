@@ -0,0 +1,79 @@
+#ifndef CLUSTERZI_ZIDM_CACHE_H
+#define CLUSTERZI_ZIDM_CACHE_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "zidm_simd.h"
+
+/* Cached per-cluster quantities for the Dirichlet-multinomial marginal.
+ *
+ * log_marginal() only depends on beta_k through xi_k = exp(beta_k). For a
+ * given cluster we keep xi_k, lgamma(xi_k) and the sum of xi_k over all taxa,
+ * so a marginal evaluation does not need any exp() and only one lgamma() per
+ * non-zero count. The cache of a cluster has to be refreshed whenever its
+ * beta_k changes (accepted MH move or a newly created cluster in the SM).
+ * The marginal itself is evaluated on the sparse counts, see zidm_data.h.
+ *
+ * For an integer count m, lgamma(m + xi) - lgamma(xi) is the log rising
+ * factorial sum_{r < m} log(xi + r). tabulate() stores these sums for every
+ * taxon up to the table length given by the data, so the marginal only needs
+ * an lgamma for the counts beyond the table. The table is built with one
+ * log() per entry and is dropped by set(); the proposals of the beta update,
+ * which are evaluated only once, are not tabulated. The exp(), lgamma() and
+ * log() of set() and tabulate() use the batch kernels of zidm_simd.h.
+ */
+
+struct clus_stat {
+
+  std::vector<double> xi;
+  std::vector<double> lg_xi;
+  double sum_xi;
+  std::vector<double> rise;     // log rising factorials, see tabulate()
+  bool has_rise;
+
+  clus_stat(): sum_xi(0.0), has_rise(false) {}
+
+  // beta_k[j * stride] is the j-th element of beta_k
+  void set(const double *beta_k, std::size_t p, std::size_t stride = 1){
+    xi.resize(p);
+    lg_xi.resize(p);
+    for(std::size_t j = 0; j < p; ++j){
+      xi[j] = beta_k[j * stride];
+    }
+    vexp(&xi[0], p);
+    vlgamma(&xi[0], &lg_xi[0], p);
+    sum_xi = 0.0;
+    for(std::size_t j = 0; j < p; ++j){
+      sum_xi += xi[j];
+    }
+    has_rise = false;
+  }
+
+  // rise[ptr[j] + m - 1] = lgamma(xi[j] + m) - lgamma(xi[j]) for
+  // m = 1, ..., ptr[j + 1] - ptr[j]
+  void tabulate(const std::vector<std::uint32_t> &ptr){
+    rise.resize(ptr.back());
+    for(std::size_t j = 0; j < xi.size(); ++j){
+      for(std::uint32_t e = ptr[j]; e < ptr[j + 1]; ++e){
+        rise[e] = xi[j] + (e - ptr[j]);
+      }
+    }
+    if(not rise.empty()){
+      vlog(&rise[0], rise.size());
+    }
+    for(std::size_t j = 0; j < xi.size(); ++j){
+      for(std::uint32_t e = ptr[j] + 1; e < ptr[j + 1]; ++e){
+        rise[e] += rise[e - 1];
+      }
+    }
+    has_rise = true;
+  }
+
+};
+
+typedef std::vector<clus_stat> clus_cache;
+
+#endif
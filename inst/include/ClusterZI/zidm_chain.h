@@ -0,0 +1,686 @@
+#ifndef CLUSTERZI_ZIDM_CHAIN_H
+#define CLUSTERZI_ZIDM_CHAIN_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "zidm_checkpoint.h"
+#include "zidm_profile.h"
+#include "zidm_psm.h"
+#include "zidm_sampler.h"
+#include "zidm_trace.h"
+
+/* One DM-ZIDM/ZIDM-ZIDM chain: its parameters, state, recorded traces and
+ * checkpoints, and run_chain(), which runs the update kernels of
+ * zidm_sampler.h in order. Invalid arguments throw std::invalid_argument
+ * (Rcpp turns it into an R error).
+ */
+
+struct zidm_param {
+  
+  /* Hyperparameters and tuning constants of the DM-ZIDM/ZIDM-ZIDM samplers */
+  
+  unsigned int K_max;
+  arma::vec theta_vec;
+  unsigned int launch_iter;
+  double MH_var;
+  double mu;
+  double s2;
+  bool at_risk;
+  double r0g;
+  double r1g;
+  double r0c;
+  double r1c;
+  bool blocked;        // blocked reallocation given tau (realloc_mode)
+  unsigned int sm_attempts;
+  unsigned int sm_schedule;
+  unsigned int sm_every;
+  bool MH_adapt;       // adapt the beta proposals during burn_in
+  unsigned int beta_block;   // taxa per beta block, 0 for all jointly
+  bool profile;        // time the steps (see zidm_profile.h)
+  bool psm;            // accumulate the PSM (see zidm_psm.h)
+  
+};
+
+inline bool blocked_realloc(const std::string &realloc_mode){
+  
+  /* Parse the realloc_mode argument of the samplers */
+  
+  if(realloc_mode == "blocked"){
+    return true;
+  } else if(realloc_mode != "sequential"){
+    throw std::invalid_argument("realloc_mode must be either \"sequential\" "
+                                "or \"blocked\".");
+  }
+  return false;
+  
+}
+
+inline void check_threads(unsigned int n_threads){
+  
+  /* The n_threads argument of the samplers; OpenMP would run a team of its 
+     own size with 0 */
+  
+  if(n_threads == 0){
+    throw std::invalid_argument("n_threads must be a positive integer.");
+  }
+  
+}
+
+// Split-merge schedules (sm_schedule)
+enum sm_plan {
+  sm_fixed = 0,
+  sm_every_k = 1,
+  sm_adaptive = 2
+};
+
+inline unsigned int sm_plan_type(const std::string &sm_schedule,
+                                 unsigned int sm_attempts,
+                                 unsigned int sm_every){
+  
+  /* Parse the sm_schedule argument of the samplers */
+  
+  if(sm_schedule == "fixed"){
+    return sm_fixed;
+  } else if(sm_schedule == "every"){
+    if(sm_every == 0){
+      throw std::invalid_argument("sm_every must be positive.");
+    }
+    return sm_every_k;
+  } else if(sm_schedule == "adaptive"){
+    if(sm_attempts == 0){
+      throw std::invalid_argument("sm_attempts must be positive with "
+                                  "sm_schedule = \"adaptive\".");
+    }
+    return sm_adaptive;
+  }
+  throw std::invalid_argument("sm_schedule must be \"fixed\", \"every\" or "
+                              "\"adaptive\".");
+  
+}
+
+struct chain_trace {
+  
+  /* Recorded output of one chain at the kept iterations. Only the selected 
+     traces are allocated, and loglik is only filled when requested. */
+  
+  arma::mat assign;
+  arma::cube gamma;
+  arma::cube beta;
+  arma::mat tau;
+  arma::vec U;
+  arma::vec logA;
+  arma::vec sm;
+  arma::vec accept;
+  arma::vec attempts;
+  arma::vec K_active;
+  arma::vec loglik;
+  arma::vec beta_accept;   // after burn_in, by cluster
+  arma::vec beta_scale;
+  arma::vec beta_sd;
+  chain_profile profile;   // only on with param.profile
+  psm_accum psm;           // only accumulated with param.psm
+  
+};
+
+inline double log_lik(const zidm_data &data, const arma::uvec &clus_assign, 
+                      const at_risk_vec &gamma, const clus_cache &cache){
+  
+  /* log p(z | assign, gamma, beta) with the multinomial probabilities 
+     integrated out */
+  
+  double result = 0.0;
+  for(unsigned int i = 0; i < data.n; ++i){
+    result += log_marginal(data, i, gamma, cache[clus_assign[i]]);
+  }
+  return result;
+  
+}
+
+struct chain_state {
+  
+  /* State of a DM-ZIDM/ZIDM-ZIDM chain between two iterations */
+  
+  unsigned int iter;   // number of completed iterations
+  arma::uvec assign;
+  at_risk_vec gamma;   // at-risk indicators of the zero counts
+  arma::mat beta;
+  arma::vec tau;
+  double U;
+  double sm_tried;     // split-merge proposals and acceptances so far, for
+  double sm_accepted;  // the adaptive schedule
+  beta_adapt mh;       // scales of the beta proposals
+  trace_position trace_pos;   // trace file at the last checkpoint
+  
+};
+
+inline void init_state(chain_state &state, const zidm_data &data, 
+                       const zidm_param &param, const rng_key &key){
+  state.iter = 0;
+  state.assign.zeros(data.n);
+  state.gamma.assign(data.n_zero(), 1);
+  state.beta.ones(param.K_max, data.p);
+  state.tau.zeros(param.K_max);
+  rng_stream rng_init(key, 0, step_init);
+  state.tau.row(0).fill(rng_init.gamma(param.theta_vec[0], 1.0));
+  state.U = rng_init.gamma(data.n, 1/(arma::accu(state.tau)));
+  state.sm_tried = 0.0;
+  state.sm_accepted = 0.0;
+  state.mh = beta_adapt(param.K_max, data.p, param.MH_var);
+  state.trace_pos = trace_position();
+}
+
+inline void save_state(const std::string &file, const chain_state &state, 
+                       const zidm_data &data, const rng_key &key, bool at_risk){
+  
+  /* Write the state and the stream key to a checkpoint file. The file keeps 
+     gamma as a dense n x p matrix, and state.trace_pos must be the position
+     of the trace file after the records of the completed iterations. */
+  
+  checkpoint ckpt;
+  ckpt.n = data.n;
+  ckpt.p = data.p;
+  ckpt.K = state.beta.n_rows;
+  ckpt.at_risk = at_risk;
+  ckpt.seed = key.seed;
+  ckpt.chain = key.chain;
+  ckpt.iter = state.iter;
+  ckpt.assign.assign(state.assign.begin(), state.assign.end());
+  ckpt.gamma.resize(static_cast<std::size_t>(data.n) * data.p);
+  data.expand(state.gamma, &ckpt.gamma[0]);
+  ckpt.beta.assign(state.beta.begin(), state.beta.end());
+  ckpt.tau.assign(state.tau.begin(), state.tau.end());
+  ckpt.U = state.U;
+  ckpt.log_scale.assign(state.mh.log_scale.begin(), state.mh.log_scale.end());
+  ckpt.sd.assign(state.mh.sd.begin(), state.mh.sd.end());
+  ckpt.n_adapt.assign(state.mh.n_adapt.begin(), state.mh.n_adapt.end());
+  ckpt.n_mom.assign(state.mh.n_mom.begin(), state.mh.n_mom.end());
+  ckpt.mean.assign(state.mh.mean.begin(), state.mh.mean.end());
+  ckpt.m2.assign(state.mh.m2.begin(), state.mh.m2.end());
+  ckpt.tried.assign(state.mh.tried.begin(), state.mh.tried.end());
+  ckpt.accepted.assign(state.mh.accepted.begin(), state.mh.accepted.end());
+  ckpt.sm_tried = state.sm_tried;
+  ckpt.sm_accepted = state.sm_accepted;
+  ckpt.trace_bytes = state.trace_pos.bytes;
+  ckpt.trace_records = state.trace_pos.records;
+  ckpt.save(file);
+  
+}
+
+inline void load_state(const std::string &file, const zidm_data &data,
+                       const zidm_param &param, chain_state &state,
+                       rng_key &key, bool &at_risk){
+  
+  /* Read a checkpoint file written by save_state for the same data. The 
+     saved adaptation of the proposals is only used with param.MH_adapt; 
+     otherwise they start from param.MH_var. */
+  
+  checkpoint ckpt;
+  ckpt.load(file);
+  if((ckpt.n != data.n) or (ckpt.p != data.p)){
+    throw std::runtime_error("z does not match the dimension of the "
+                             "checkpoint.");
+  }
+  state.iter = ckpt.iter;
+  state.assign.set_size(ckpt.n);
+  state.beta.set_size(ckpt.K, ckpt.p);
+  state.tau.set_size(ckpt.K);
+  std::copy(ckpt.assign.begin(), ckpt.assign.end(), state.assign.begin());
+  data.compress(&ckpt.gamma[0], state.gamma);
+  std::copy(ckpt.beta.begin(), ckpt.beta.end(), state.beta.begin());
+  std::copy(ckpt.tau.begin(), ckpt.tau.end(), state.tau.begin());
+  state.U = ckpt.U;
+  state.sm_tried = ckpt.sm_tried;
+  state.sm_accepted = ckpt.sm_accepted;
+  state.mh = beta_adapt(ckpt.K, ckpt.p, param.MH_var);
+  if(param.MH_adapt){
+    std::copy(ckpt.log_scale.begin(), ckpt.log_scale.end(), 
+              state.mh.log_scale.begin());
+    std::copy(ckpt.sd.begin(), ckpt.sd.end(), state.mh.sd.begin());
+    std::copy(ckpt.n_adapt.begin(), ckpt.n_adapt.end(), 
+              state.mh.n_adapt.begin());
+    std::copy(ckpt.n_mom.begin(), ckpt.n_mom.end(), state.mh.n_mom.begin());
+    std::copy(ckpt.mean.begin(), ckpt.mean.end(), state.mh.mean.begin());
+    std::copy(ckpt.m2.begin(), ckpt.m2.end(), state.mh.m2.begin());
+  }
+  std::copy(ckpt.tried.begin(), ckpt.tried.end(), state.mh.tried.begin());
+  std::copy(ckpt.accepted.begin(), ckpt.accepted.end(), 
+            state.mh.accepted.begin());
+  state.trace_pos.bytes = ckpt.trace_bytes;
+  state.trace_pos.records = ckpt.trace_records;
+  key = rng_key(ckpt.seed, ckpt.chain);
+  at_risk = ckpt.at_risk;
+  
+}
+
+inline unsigned int sm_count(const zidm_param &param, const chain_state &state, 
+                             unsigned int t){
+  
+  /* Number of split-merge proposals at iteration t. "fixed" makes 
+     sm_attempts proposals every iteration and "every" makes them every 
+     sm_every-th iteration. "adaptive" makes about as many proposals as are
+     needed for one acceptance, 1 / (acceptance rate), between 1 and 
+     sm_attempts; the rate is estimated from all the proposals of the chain
+     so far, starting from 1/2. Each proposal leaves the posterior invariant,
+     so the number of proposals can depend on the past of the chain. */
+  
+  if(param.sm_schedule == sm_every_k){
+    return ((t + 1) % param.sm_every == 0) ? param.sm_attempts : 0;
+  } else if(param.sm_schedule == sm_adaptive){
+    double rate = (state.sm_accepted + 1.0) / (state.sm_tried + 2.0);
+    double n_sm = std::ceil(1.0 / rate);
+    return (n_sm < param.sm_attempts) ? (unsigned int)n_sm : param.sm_attempts;
+  }
+  return param.sm_attempts;
+  
+}
+
+inline trace_dims make_dims(const zidm_data &data, unsigned int K_max){
+  trace_dims dims;
+  dims.n = data.n;
+  dims.p = data.p;
+  dims.K = K_max;
+  return dims;
+}
+
+inline void run_chain(chain_trace &trace, chain_state &state, unsigned int iter,
+                      const zidm_data &data, const zidm_param &param,
+                      const trace_select &sel, const rng_key &key,
+                      unsigned int n_threads, int print_iter,
+                      bool record_loglik, trace_writer *sink,
+                      const std::string &ckpt_file = "",
+                      unsigned int ckpt_every = 0){
+  
+  /* Run iter more iterations of the ZIDM-ZIDM sampler (or DM-ZIDM when 
+     param.at_risk is false) from state, which is updated in place. It only 
+     uses the counter-based streams and does not touch any R object, so 
+     several chains can run on separate threads. Only the traces selected by 
+     sel are recorded at the kept iterations (counted from the first 
+     iteration of the chain, so that a resumed chain keeps the iterations of
+     an uninterrupted one); when a sink is given, they go to disk instead 
+     of memory. When ckpt_file is given, the state is saved there every 
+     ckpt_every iterations and at the end, with the position of the sink. 
+     With param.MH_adapt, the beta proposals are adapted during the burn-in 
+     iterations; the acceptance rates of beta are counted after them. With 
+     param.beta_block, beta is updated by blocks of taxa (see 
+     update_beta_blocked). With param.profile, the time and the acceptances 
+     of every step go to trace.profile. With param.psm, the labels of the 
+     kept iterations are also added to trace.psm, whatever sel records. */
+  
+  const unsigned int K_max = param.K_max;
+  const unsigned int t0 = state.iter;
+  const unsigned int n_keep = sel.n_keep(t0, iter);
+  
+  // Store the result
+  if(sink == NULL){
+    if(sel.has(trace_assign)){
+      trace.assign.set_size(n_keep, data.n);
+    }
+    if(sel.has(trace_gamma)){
+      trace.gamma.set_size(data.n, data.p, n_keep);
+    }
+    if(sel.has(trace_beta)){
+      trace.beta.set_size(K_max, data.p, n_keep);
+    }
+    if(sel.has(trace_tau)){
+      trace.tau.set_size(n_keep, K_max);
+    }
+    if(sel.has(trace_U)){
+      trace.U.set_size(n_keep);
+    }
+    if(sel.has(trace_logA)){
+      trace.logA.set_size(n_keep);
+    }
+  }
+  trace.sm.zeros(n_keep);
+  trace.accept.zeros(n_keep);
+  trace.attempts.zeros(n_keep);
+  trace.K_active.zeros(n_keep);
+  if(record_loglik){
+    trace.loglik.zeros(n_keep);
+  }
+  if(param.psm){
+    trace.psm.init(data.n, K_max);
+  }
+  
+  // MCMC object; the state is updated in place
+  clus_cache cache = make_cache(state.beta, data);
+  sampler_work work(data.n, data.p, K_max);
+  beta_blocks blk(data, K_max, 
+                  param.beta_block > 0 ? param.beta_block : data.p);
+  std::vector<unsigned char> gamma_out;   // dense n x p gamma for the sink
+  if((sink != NULL) and sink->has(trace_gamma)){
+    gamma_out.resize(static_cast<std::size_t>(data.n) * data.p);
+  }
+  
+  // Profile; prof stays NULL, and the steps are not timed, without it
+  trace.profile = chain_profile(param.profile);
+  chain_profile *prof = param.profile ? &trace.profile : NULL;
+  profile_clock::time_point t_run, t_step;
+  if(prof != NULL){
+    t_run = profile_clock::now();
+  }
+  
+  // Begin; t is the global iteration, so the streams continue on resume, 
+  // and r the next kept iteration of this call
+  unsigned int r = 0;
+  for(unsigned int t = t0; t < t0 + iter; ++t){
+    
+    bool burning = (t < sel.burn_in);
+    if(t == sel.burn_in){
+      state.mh.reset_counts();
+    }
+    
+    // Update at-risk
+    if(param.at_risk){
+      if(prof != NULL){
+        t_step = profile_clock::now();
+      }
+      std::size_t n_flip = update_at_risk(data, state.assign, state.gamma, 
+                                          cache, param.r0g, param.r1g, key, t, 
+                                          n_threads);
+      if(prof != NULL){
+        prof->add(prof_at_risk, t_step);
+        prof->count(prof_at_risk, state.gamma.size(), n_flip);
+      }
+    }
+    
+    // Update beta
+    bool adapt = param.MH_adapt and burning;
+    double beta_tried = 0.0, beta_accepted = 0.0;
+    if(prof != NULL){
+      beta_tried = arma::accu(state.mh.tried);
+      beta_accepted = arma::accu(state.mh.accepted);
+      t_step = profile_clock::now();
+    }
+    if(param.beta_block > 0){
+      update_beta_blocked(data, state.assign, state.gamma, state.beta, cache, 
+                          param.mu, param.s2, state.mh, adapt, key, t, work, 
+                          blk);
+    } else {
+      update_beta(data, state.assign, state.gamma, state.beta, cache, param.mu, 
+                  param.s2, state.mh, adapt, key, t, work);
+    }
+    if(prof != NULL){
+      prof->add(prof_beta, t_step);
+      prof->count(prof_beta, arma::accu(state.mh.tried) - beta_tried, 
+                  arma::accu(state.mh.accepted) - beta_accepted);
+    }
+    
+    // Reallocate, and set tau of the emptied clusters to 0
+    if(prof != NULL){
+      t_step = profile_clock::now();
+    }
+    if(param.blocked){
+      realloc_blocked(data, state.assign, state.gamma, cache, state.tau, key, 
+                      t, n_threads, work);
+    } else {
+      realloc(data, state.assign, state.gamma, cache, param.theta_vec, key, t, 
+              work);
+    }
+    for(unsigned int k = 0; k < K_max; ++k){
+      if(work.nk[k] == 0){
+        state.tau[k] = 0.0;
+      }
+    }
+    if(prof != NULL){
+      prof->add(prof_realloc, t_step);
+    }
+    
+    // Split-Merge; proposal a uses its own stream, and sm_out keeps the 
+    // last proposal and the number of accepted ones
+    unsigned int n_sm = sm_count(param, state, t);
+    sm_result sm_out = {0.0, -1, 0};
+    for(unsigned int a = 0; a < n_sm; ++a){
+      rng_stream rng_sm(key, t, step_sm, a);
+      int n_accept = sm_out.sm_accept;
+      if(prof != NULL){
+        t_step = profile_clock::now();
+      }
+      sm_out = sm(K_max, data, state.assign, state.gamma, state.beta, cache, 
+                  state.tau, param.theta_vec, param.launch_iter, param.mu, 
+                  param.s2, param.r0c, param.r1c, rng_sm, n_threads, work);
+      if(prof != NULL){
+        int step = (sm_out.expand_ind == 1) ? prof_split : prof_merge;
+        prof->add(step, t_step);
+        prof->count(step, 1.0, sm_out.sm_accept);
+      }
+      sm_out.sm_accept += n_accept;
+    }
+    state.sm_tried += n_sm;
+    state.sm_accepted += sm_out.sm_accept;
+    
+    // Update tau and U; work.n_active is the number of active clusters
+    if(prof != NULL){
+      t_step = profile_clock::now();
+    }
+    update_tau(state.assign, state.tau, param.theta_vec, state.U, key, t, work);
+    if(prof != NULL){
+      prof->add(prof_tau, t_step);
+      t_step = profile_clock::now();
+    }
+    
+    // Record the result
+    if(sel.keep(t)){
+      trace.sm[r] = sm_out.expand_ind;
+      trace.accept[r] = sm_out.sm_accept;
+      trace.attempts[r] = n_sm;
+      trace.K_active[r] = work.n_active;
+      if(record_loglik){
+        trace.loglik[r] = log_lik(data, state.assign, state.gamma, cache);
+      }
+      if(param.psm){
+        trace.psm.add(state.assign);
+      }
+      if(sink == NULL){
+        if(sel.has(trace_assign)){
+          for(unsigned int i = 0; i < data.n; ++i){
+            trace.assign(r, i) = state.assign[i];
+          }
+        }
+        if(sel.has(trace_gamma)){
+          data.expand(state.gamma, trace.gamma.slice_memptr(r));
+        }
+        if(sel.has(trace_beta)){
+          trace.beta.slice(r) = state.beta;
+        }
+        if(sel.has(trace_tau)){
+          trace.tau.row(r) = state.tau.t();
+        }
+        if(sel.has(trace_U)){
+          trace.U[r] = state.U;
+        }
+        if(sel.has(trace_logA)){
+          trace.logA[r] = sm_out.logA;
+        }
+      } else {
+        if(sink->has(trace_assign)){
+          sink->put_labels(state.assign.memptr());
+        }
+        if(sink->has(trace_gamma)){
+          data.expand(state.gamma, &gamma_out[0]);
+          sink->put_bits(trace_gamma, &gamma_out[0]);
+        }
+        if(sink->has(trace_beta)){
+          sink->put_doubles(trace_beta, state.beta.memptr());
+        }
+        if(sink->has(trace_tau)){
+          sink->put_doubles(trace_tau, state.tau.memptr());
+        }
+        if(sink->has(trace_U)){
+          sink->put_scalar(trace_U, state.U);
+        }
+        if(sink->has(trace_logA)){
+          sink->put_scalar(trace_logA, sm_out.logA);
+        }
+        if(sink->has(trace_sm)){
+          sink->put_scalar(trace_sm, sm_out.expand_ind);
+        }
+        if(sink->has(trace_accept)){
+          sink->put_scalar(trace_accept, sm_out.sm_accept);
+        }
+      }
+      r += 1;
+    }
+    
+    state.iter = t + 1;
+    
+    // Checkpoint, after the traces up to this iteration are on disk
+    if((not ckpt_file.empty()) and (ckpt_every > 0) and 
+         ((t + 1) % ckpt_every == 0)){
+      state.trace_pos = (sink != NULL) ? sink->position() : trace_position();
+      save_state(ckpt_file, state, data, key, param.at_risk);
+    }
+    
+    // Print the result
+    if((print_iter > 0) and ((t + 1) % print_iter == 0)){
+      std::cout << "Iter: " << (t+1) << " - Done!" << std::endl;
+    }
+    if(prof != NULL){
+      prof->add(prof_output, t_step);
+    }
+    
+  }
+  
+  if((not ckpt_file.empty()) and 
+       ((ckpt_every == 0) or (state.iter % ckpt_every != 0))){
+    state.trace_pos = (sink != NULL) ? sink->position() : trace_position();
+    save_state(ckpt_file, state, data, key, param.at_risk);
+  }
+  
+  if(param.psm){
+    trace.psm.flush();
+  }
+  
+  // Acceptance rates and scales of the beta proposals
+  trace.beta_accept = state.mh.accept_rate();
+  trace.beta_scale = arma::exp(state.mh.log_scale);
+  trace.beta_sd = state.mh.sd;
+  if(prof != NULL){
+    prof->add(prof_total, t_run);
+  }
+  
+}
+
+inline void run_dm_chain(chain_trace &trace, chain_state &state, 
+                         unsigned int iter, const zidm_data &data, 
+                         const zidm_param &param, const trace_select &sel, 
+                         const rng_key &key, int print_iter, 
+                         trace_writer *sink){
+  
+  /* Run iter more iterations of the DM-DM sampler from state. The number of
+     clusters is fixed at K_max and the at-risk indicators are not updated 
+     (state.gamma stays 1), so an iteration only updates beta and draws the 
+     labels one after the other over all K_max clusters, with weights 
+     theta_k + n_k. Only the assign and beta traces of sel are recorded, and 
+     the PSM with param.psm. */
+  
+  const unsigned int K_max = param.K_max;
+  const unsigned int t0 = state.iter;
+  const unsigned int n_keep = sel.n_keep(t0, iter);
+  if(sink == NULL){
+    if(sel.has(trace_assign)){
+      trace.assign.set_size(n_keep, data.n);
+    }
+    if(sel.has(trace_beta)){
+      trace.beta.set_size(K_max, data.p, n_keep);
+    }
+  }
+  if(param.psm){
+    trace.psm.init(data.n, K_max);
+  }
+  
+  // MCMC object; the state is updated in place
+  clus_cache cache = make_cache(state.beta, data);
+  sampler_work work(data.n, data.p, K_max);
+  beta_blocks blk(data, K_max, 
+                  param.beta_block > 0 ? param.beta_block : data.p);
+  std::vector<unsigned int> all_clus(K_max);
+  for(unsigned int k = 0; k < K_max; ++k){
+    all_clus[k] = k;
+  }
+  
+  unsigned int r = 0;
+  for(unsigned int t = t0; t < t0 + iter; ++t){
+    
+    // Update beta
+    bool adapt = param.MH_adapt and (t < sel.burn_in);
+    if(param.beta_block > 0){
+      update_beta_blocked(data, state.assign, state.gamma, state.beta, cache, 
+                          param.mu, param.s2, state.mh, adapt, key, t, work, 
+                          blk);
+    } else {
+      update_beta(data, state.assign, state.gamma, state.beta, cache, param.mu, 
+                  param.s2, state.mh, adapt, key, t, work);
+    }
+    
+    // Reallocate over all K_max clusters
+    arma::vec &nk = work.nk;
+    work.count(state.assign);
+    
+    for(unsigned int i = 0; i < data.n; ++i){
+      
+      nk[state.assign[i]] -= 1;
+      
+      double *log_prob = work.log_prob.memptr();
+      
+      log_marginal(data, i, state.gamma, cache, &all_clus[0], K_max, log_prob, 
+                   &work.lgamma_buf[0]);
+      for(unsigned int k = 0; k < K_max; ++k){
+        log_prob[k] += std::log(param.theta_vec[k] + nk[k]);
+      }
+      
+      rng_stream rng(key, t, step_realloc, i);
+      
+      // New assign
+      state.assign[i] = log_categorical(log_prob, K_max, rng);
+      
+      nk[state.assign[i]] += 1;
+      
+    }
+    
+    // Record the result
+    if(sel.keep(t)){
+      if(param.psm){
+        trace.psm.add(state.assign);
+      }
+      if(sink == NULL){
+        if(sel.has(trace_assign)){
+          for(unsigned int i = 0; i < data.n; ++i){
+            trace.assign(r, i) = state.assign[i];
+          }
+        }
+        if(sel.has(trace_beta)){
+          trace.beta.slice(r) = state.beta;
+        }
+      } else {
+        if(sink->has(trace_assign)){
+          sink->put_labels(state.assign.memptr());
+        }
+        if(sink->has(trace_beta)){
+          sink->put_doubles(trace_beta, state.beta.memptr());
+        }
+      }
+      r += 1;
+    }
+    
+    state.iter = t + 1;
+    
+    // Print the result
+    if((print_iter > 0) and ((t + 1) % print_iter == 0)){
+      std::cout << "Iter: " << (t+1) << " - Done!" << std::endl;
+    }
+    
+  }
+  if(param.psm){
+    trace.psm.flush();
+  }
+  
+}
+
+#endif
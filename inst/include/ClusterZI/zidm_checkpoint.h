@@ -0,0 +1,228 @@
+#ifndef CLUSTERZI_ZIDM_CHECKPOINT_H
+#define CLUSTERZI_ZIDM_CHECKPOINT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Binary checkpoint of a DM-ZIDM/ZIDM-ZIDM chain.
+ *
+ * A checkpoint holds the complete state between two iterations: the labels,
+ * the at-risk indicators, beta, tau, U, the adaptation of the beta
+ * proposals, the split-merge counts of the adaptive schedule, the number of
+ * completed iterations and the key of the random streams, as well as the
+ * position of the trace file. Since every draw of iteration t only depends
+ * on the key, t and this state, a chain resumed from a checkpoint continues
+ * exactly as if it had never stopped.
+ *
+ * File layout (host byte order): magic "CZICKPT1", the fixed-size header,
+ * the payload and a 64-bit FNV-1a hash of the payload. The payload holds
+ * uint32 labels, uint8 at-risk indicators, double beta, tau and U, the K
+ * log-scales and the p sds of the beta proposals, the K adaptation steps
+ * and moment counts, the K x p running means and sums of squares, the K
+ * proposals and acceptances, the split-merge proposals and acceptances, and
+ * uint64 length and records of the trace file, all column-major. The file
+ * is written to path.tmp and then renamed, so an interruption while saving
+ * leaves the previous checkpoint intact.
+ */
+
+static const char checkpoint_magic[8] = {'C', 'Z', 'I', 'C', 'K', 'P', 'T',
+                                         '1'};
+
+struct checkpoint_header {
+  char magic[8];
+  std::uint32_t n;
+  std::uint32_t p;
+  std::uint32_t K;
+  std::uint32_t at_risk;
+  std::uint64_t seed;
+  std::uint64_t chain;
+  std::uint64_t iter;
+};
+
+inline std::uint64_t fnv1a(const unsigned char *x, std::size_t size,
+                           std::uint64_t h = 0xcbf29ce484222325ULL){
+  for(std::size_t b = 0; b < size; ++b){
+    h ^= x[b];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+struct checkpoint {
+
+  std::uint32_t n;
+  std::uint32_t p;
+  std::uint32_t K;
+  bool at_risk;
+  std::uint64_t seed;
+  std::uint64_t chain;
+  std::uint64_t iter;              // number of completed iterations
+  std::vector<std::uint32_t> assign;
+  std::vector<unsigned char> gamma;
+  std::vector<double> beta;
+  std::vector<double> tau;
+  double U;
+  std::vector<double> log_scale;   // beta proposals (see beta_adapt)
+  std::vector<double> sd;
+  std::vector<double> n_adapt;
+  std::vector<double> n_mom;
+  std::vector<double> mean;
+  std::vector<double> m2;
+  std::vector<double> tried;
+  std::vector<double> accepted;
+  double sm_tried;
+  double sm_accepted;
+  std::uint64_t trace_bytes;       // see trace_position
+  std::uint64_t trace_records;
+
+  checkpoint(): n(0), p(0), K(0), at_risk(true), seed(0), chain(0), iter(0),
+    U(0.0), sm_tried(0.0), sm_accepted(0.0),
+    trace_bytes(0), trace_records(0) {}
+
+  void save(const std::string &path) const {
+
+    checkpoint_header header;
+    std::memcpy(header.magic, checkpoint_magic, 8);
+    header.n = n;
+    header.p = p;
+    header.K = K;
+    header.at_risk = at_risk;
+    header.seed = seed;
+    header.chain = chain;
+    header.iter = iter;
+
+    std::vector<unsigned char> payload;
+    put(payload, assign.data(), assign.size() * sizeof(std::uint32_t));
+    put(payload, gamma.data(), gamma.size());
+    put(payload, beta.data(), beta.size() * sizeof(double));
+    put(payload, tau.data(), tau.size() * sizeof(double));
+    put(payload, &U, sizeof(double));
+    put(payload, log_scale.data(), log_scale.size() * sizeof(double));
+    put(payload, sd.data(), sd.size() * sizeof(double));
+    put(payload, n_adapt.data(), n_adapt.size() * sizeof(double));
+    put(payload, n_mom.data(), n_mom.size() * sizeof(double));
+    put(payload, mean.data(), mean.size() * sizeof(double));
+    put(payload, m2.data(), m2.size() * sizeof(double));
+    put(payload, tried.data(), tried.size() * sizeof(double));
+    put(payload, accepted.data(), accepted.size() * sizeof(double));
+    put(payload, &sm_tried, sizeof(double));
+    put(payload, &sm_accepted, sizeof(double));
+    put(payload, &trace_bytes, sizeof(std::uint64_t));
+    put(payload, &trace_records, sizeof(std::uint64_t));
+    std::uint64_t hash = fnv1a(&payload[0], payload.size());
+
+    std::string tmp = path + ".tmp";
+    std::FILE *file = std::fopen(tmp.c_str(), "wb");
+    if(file == NULL){
+      throw std::runtime_error("checkpoint: cannot open " + tmp);
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 and
+      std::fwrite(&payload[0], 1, payload.size(), file) == payload.size() and
+      std::fwrite(&hash, sizeof(hash), 1, file) == 1;
+    ok = (std::fclose(file) == 0) and ok;
+    if(not ok){
+      std::remove(tmp.c_str());
+      throw std::runtime_error("checkpoint: cannot write " + tmp);
+    }
+
+    // rename() does not replace an existing file on Windows
+    #if defined(_WIN32)
+    std::remove(path.c_str());
+    #endif
+    if(std::rename(tmp.c_str(), path.c_str()) != 0){
+      throw std::runtime_error("checkpoint: cannot rename " + tmp);
+    }
+
+  }
+
+  void load(const std::string &path){
+
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if(file == NULL){
+      throw std::runtime_error("checkpoint: cannot open " + path);
+    }
+
+    checkpoint_header header;
+    if(std::fread(&header, sizeof(header), 1, file) != 1 or
+         std::memcmp(header.magic, checkpoint_magic, 8) != 0){
+      std::fclose(file);
+      throw std::runtime_error(path + " is not a ClusterZI checkpoint.");
+    }
+
+    n = header.n;
+    p = header.p;
+    K = header.K;
+    at_risk = header.at_risk != 0;
+    seed = header.seed;
+    chain = header.chain;
+    iter = header.iter;
+    assign.resize(n);
+    gamma.resize(static_cast<std::size_t>(n) * p);
+    beta.resize(static_cast<std::size_t>(K) * p);
+    tau.resize(K);
+    log_scale.resize(K);
+    sd.resize(p);
+    const std::size_t Kp = static_cast<std::size_t>(K) * p;
+    n_adapt.resize(K);
+    n_mom.resize(K);
+    mean.resize(Kp);
+    m2.resize(Kp);
+    tried.resize(K);
+    accepted.resize(K);
+
+    std::size_t size = assign.size() * sizeof(std::uint32_t) + gamma.size() +
+      (beta.size() + tau.size() + 1 + log_scale.size() + sd.size() +
+       n_adapt.size() + n_mom.size() + mean.size() + m2.size() +
+       tried.size() + accepted.size() + 2) * sizeof(double) +
+      2 * sizeof(std::uint64_t);
+    std::vector<unsigned char> payload(size);
+    std::uint64_t hash = 0;
+    bool ok = std::fread(&payload[0], 1, size, file) == size and
+      std::fread(&hash, sizeof(hash), 1, file) == 1;
+    std::fclose(file);
+    if(not ok or hash != fnv1a(&payload[0], payload.size())){
+      throw std::runtime_error(path + " is truncated or corrupted.");
+    }
+
+    std::size_t offset = 0;
+    get(payload, offset, assign.data(), assign.size() * sizeof(std::uint32_t));
+    get(payload, offset, gamma.data(), gamma.size());
+    get(payload, offset, beta.data(), beta.size() * sizeof(double));
+    get(payload, offset, tau.data(), tau.size() * sizeof(double));
+    get(payload, offset, &U, sizeof(double));
+    get(payload, offset, log_scale.data(), log_scale.size() * sizeof(double));
+    get(payload, offset, sd.data(), sd.size() * sizeof(double));
+    get(payload, offset, n_adapt.data(), n_adapt.size() * sizeof(double));
+    get(payload, offset, n_mom.data(), n_mom.size() * sizeof(double));
+    get(payload, offset, mean.data(), mean.size() * sizeof(double));
+    get(payload, offset, m2.data(), m2.size() * sizeof(double));
+    get(payload, offset, tried.data(), tried.size() * sizeof(double));
+    get(payload, offset, accepted.data(), accepted.size() * sizeof(double));
+    get(payload, offset, &sm_tried, sizeof(double));
+    get(payload, offset, &sm_accepted, sizeof(double));
+    get(payload, offset, &trace_bytes, sizeof(std::uint64_t));
+    get(payload, offset, &trace_records, sizeof(std::uint64_t));
+
+  }
+
+private:
+
+  static void put(std::vector<unsigned char> &out, const void *x,
+                  std::size_t size){
+    const unsigned char *b = static_cast<const unsigned char *>(x);
+    out.insert(out.end(), b, b + size);
+  }
+
+  static void get(const std::vector<unsigned char> &in, std::size_t &offset,
+                  void *x, std::size_t size){
+    std::memcpy(x, &in[offset], size);
+    offset += size;
+  }
+
+};
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef CLUSTERZI_ZIDM_DATA_H
+#define CLUSTERZI_ZIDM_DATA_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "zidm_cache.h"
+
+/* Sparse count table for the samplers.
+ *
+ * Microbiome tables are mostly zeros, and the model treats the two kinds of
+ * entries differently: a non-zero count is always at risk (gamma_ij = 1) and
+ * adds lgamma(z_ij + xi_kj) - lgamma(xi_kj) to the marginal, while a zero
+ * count only matters through its at-risk indicator. The table is therefore
+ * stored row by row (CSR) as two lists per sample: the non-zero counts with
+ * their taxa, and the taxa with a zero count. The at-risk indicators are
+ * kept for the zero entries only, in the order of the zero lists, so that
+ * the indicators of sample i are gamma[zero_ptr[i]] ... gamma[zero_ptr[i+1]-1].
+ * The table is built once when a sampler starts.
+ *
+ * The rising factorial tables of the clusters (see clus_stat::tabulate) hold
+ * the counts 1, ..., min(max count, rise_cap) of every taxon; rise_ptr gives
+ * their layout and nz_rise the table entry of every non-zero count, or
+ * no_rise when the count is beyond the table.
+ */
+
+typedef std::vector<unsigned char> at_risk_vec;
+
+static const std::uint32_t no_rise = 0xFFFFFFFFu;
+
+struct zidm_data {
+
+  unsigned int n;
+  unsigned int p;
+  std::vector<std::uint32_t> nz_ptr;     // row i is nz_ptr[i] ... nz_ptr[i+1]-1
+  std::vector<std::uint32_t> nz_col;
+  std::vector<std::uint32_t> nz_count;
+  std::vector<std::uint32_t> zero_ptr;   // row i is zero_ptr[i] ... zero_ptr[i+1]-1
+  std::vector<std::uint32_t> zero_col;
+  std::vector<double> total;             // sum of the counts of each sample
+  std::vector<std::uint32_t> rise_ptr;   // taxon j is rise_ptr[j] ... rise_ptr[j+1]-1
+  std::vector<std::uint32_t> nz_rise;
+
+  // z[i + j * n] is the count of sample i and taxon j (column-major)
+  zidm_data(const double *z, unsigned int n_, unsigned int p_,
+            std::uint32_t rise_cap = 64):
+    n(n_), p(p_), nz_ptr(n_ + 1, 0), zero_ptr(n_ + 1, 0), total(n_, 0.0),
+    rise_ptr(p_ + 1, 0) {
+
+    std::vector<std::uint32_t> max_count(p, 0);
+
+    for(unsigned int i = 0; i < n; ++i){
+      for(unsigned int j = 0; j < p; ++j){
+        double z_ij = z[i + static_cast<std::size_t>(j) * n];
+        if(not (z_ij >= 0 and z_ij == std::floor(z_ij) and z_ij < 4294967296.0)){
+          throw std::runtime_error("z must contain non-negative integer counts.");
+        }
+        if(z_ij == 0){
+          zero_col.push_back(j);
+        } else {
+          nz_col.push_back(j);
+          nz_count.push_back(static_cast<std::uint32_t>(z_ij));
+          total[i] += z_ij;
+          max_count[j] = std::max(max_count[j], nz_count.back());
+        }
+      }
+      nz_ptr[i + 1] = nz_col.size();
+      zero_ptr[i + 1] = zero_col.size();
+    }
+
+    for(unsigned int j = 0; j < p; ++j){
+      rise_ptr[j + 1] = rise_ptr[j] + std::min(max_count[j], rise_cap);
+    }
+    nz_rise.resize(nz_col.size());
+    for(std::size_t e = 0; e < nz_col.size(); ++e){
+      unsigned int j = nz_col[e];
+      bool in_table = nz_count[e] <= rise_ptr[j + 1] - rise_ptr[j];
+      nz_rise[e] = in_table ? rise_ptr[j] + nz_count[e] - 1 : no_rise;
+    }
+
+  }
+
+  std::size_t n_zero() const {
+    return zero_col.size();
+  }
+
+  // Expand the at-risk indicators to a dense column-major n x p matrix
+  template <typename T>
+  void expand(const at_risk_vec &gamma, T *out) const {
+    for(std::size_t v = 0; v < static_cast<std::size_t>(n) * p; ++v){
+      out[v] = 1;
+    }
+    for(unsigned int i = 0; i < n; ++i){
+      for(std::uint32_t e = zero_ptr[i]; e < zero_ptr[i + 1]; ++e){
+        out[i + static_cast<std::size_t>(zero_col[e]) * n] = gamma[e];
+      }
+    }
+  }
+
+  // Keep the indicators of the zero entries of a dense n x p matrix
+  template <typename T>
+  void compress(const T *gamma_mat, at_risk_vec &gamma) const {
+    gamma.resize(n_zero());
+    for(unsigned int i = 0; i < n; ++i){
+      for(std::uint32_t e = zero_ptr[i]; e < zero_ptr[i + 1]; ++e){
+        gamma[e] = (gamma_mat[i + static_cast<std::size_t>(zero_col[e]) * n] == 1);
+      }
+    }
+  }
+
+};
+
+inline double at_risk_xi(const zidm_data &data, unsigned int i,
+                        const at_risk_vec &gamma, const clus_stat &stat){
+
+  /* Sum of xi_k over the at-risk taxa of sample i: the cached total minus
+   * the zero entries that are not at risk. */
+
+  double sum_xi = stat.sum_xi;
+  for(std::uint32_t e = data.zero_ptr[i]; e < data.zero_ptr[i + 1]; ++e){
+    if(gamma[e] == 0){
+      sum_xi -= stat.xi[data.zero_col[e]];
+    }
+  }
+  return sum_xi;
+
+}
+
+inline double log_rising(const zidm_data &data, unsigned int i,
+                         const clus_stat &stat){
+
+  /* Sum of lgamma(z_ij + xi_kj) - lgamma(xi_kj) over the non-zero counts of
+   * sample i. Only the counts beyond the rising factorial table (or all of
+   * them, when the cluster is not tabulated) need an lgamma. */
+
+  double result = 0.0;
+  if(stat.has_rise){
+    for(std::uint32_t e = data.nz_ptr[i]; e < data.nz_ptr[i + 1]; ++e){
+      if(data.nz_rise[e] != no_rise){
+        result += stat.rise[data.nz_rise[e]];
+      } else {
+        unsigned int j = data.nz_col[e];
+        result += std::lgamma(data.nz_count[e] + stat.xi[j]) - stat.lg_xi[j];
+      }
+    }
+  } else {
+    for(std::uint32_t e = data.nz_ptr[i]; e < data.nz_ptr[i + 1]; ++e){
+      unsigned int j = data.nz_col[e];
+      result += std::lgamma(data.nz_count[e] + stat.xi[j]) - stat.lg_xi[j];
+    }
+  }
+  return result;
+
+}
+
+inline double log_marginal(const zidm_data &data, unsigned int i,
+                           const at_risk_vec &gamma, const clus_stat &stat){
+
+  /* log_marginal() of sample i, with the cached xi_k. The count sum is the
+   * total of the sample, since every non-zero count is at risk. */
+
+  double sum_xi = at_risk_xi(data, i, gamma, stat);
+  return log_rising(data, i, stat) + std::lgamma(sum_xi) -
+    std::lgamma(sum_xi + data.total[i]);
+
+}
+
+inline void log_marginal(const zidm_data &data, unsigned int i,
+                         const at_risk_vec &gamma, const clus_cache &cache,
+                         const unsigned int *clus, unsigned int K,
+                         double *out, double *buf){
+
+  /* out[kk] = log_marginal(data, i, gamma, cache[clus[kk]]) for kk < K. The
+   * 2 K lgamma of the at-risk sums go through one vlgamma call; buf holds
+   * 2 K doubles. */
+
+  for(unsigned int kk = 0; kk < K; ++kk){
+    const clus_stat &stat = cache[clus[kk]];
+    out[kk] = log_rising(data, i, stat);
+    buf[kk] = at_risk_xi(data, i, gamma, stat);
+    buf[K + kk] = buf[kk] + data.total[i];
+  }
+  vlgamma(buf, buf, 2 * K);
+  for(unsigned int kk = 0; kk < K; ++kk){
+    out[kk] += buf[kk] - buf[K + kk];
+  }
+
+}
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef CLUSTERZI_ZIDM_DIAGNOSTICS_H
+#define CLUSTERZI_ZIDM_DIAGNOSTICS_H
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+/* Convergence diagnostics for a scalar trace of M chains.
+ *
+ * The draws are stored column-major: draws[t + m * N] is iteration t of
+ * chain m, i.e. the memory layout of an N x M arma::mat. Both functions
+ * follow Gelman et al. (2013), Bayesian Data Analysis, Section 11.4-11.5:
+ * every chain is split into two halves, and the effective sample size uses
+ * Geyer's initial positive sequence on the combined autocorrelations.
+ * NaN is returned when the trace is constant, since both are undefined.
+ */
+
+struct split_chains {
+
+  std::size_t N;   // length of each half chain
+  std::size_t M;   // number of half chains
+  std::vector<double> mean;
+  std::vector<double> var;
+  double W;
+  double var_plus;
+
+  split_chains(const double *draws, std::size_t n_iter, std::size_t n_chains):
+    N(n_iter / 2), M(2 * n_chains), mean(2 * n_chains, 0.0),
+    var(2 * n_chains, 0.0), W(0.0), var_plus(0.0) {
+
+    if(N < 2){
+      return;
+    }
+
+    // The first iteration of an odd-length chain is dropped
+    std::size_t offset = n_iter - 2 * N;
+    for(std::size_t m = 0; m < M; ++m){
+      const double *x = half(draws, n_iter, offset, m);
+      for(std::size_t t = 0; t < N; ++t){
+        mean[m] += x[t];
+      }
+      mean[m] /= N;
+      for(std::size_t t = 0; t < N; ++t){
+        var[m] += (x[t] - mean[m]) * (x[t] - mean[m]);
+      }
+      var[m] /= (N - 1);
+    }
+
+    double grand_mean = 0.0;
+    for(std::size_t m = 0; m < M; ++m){
+      W += var[m];
+      grand_mean += mean[m];
+    }
+    W /= M;
+    grand_mean /= M;
+
+    double B = 0.0;
+    for(std::size_t m = 0; m < M; ++m){
+      B += (mean[m] - grand_mean) * (mean[m] - grand_mean);
+    }
+    B *= static_cast<double>(N) / (M - 1);
+
+    var_plus = (N - 1.0) / N * W + B / N;
+
+  }
+
+  const double *half(const double *draws, std::size_t n_iter,
+                     std::size_t offset, std::size_t m) const {
+    return draws + (m / 2) * n_iter + offset + (m % 2) * N;
+  }
+
+};
+
+inline double split_rhat(const double *draws, std::size_t n_iter,
+                         std::size_t n_chains){
+
+  split_chains sc(draws, n_iter, n_chains);
+  if(sc.N < 2 or sc.W <= 0.0){
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  return std::sqrt(sc.var_plus / sc.W);
+
+}
+
+inline double ess(const double *draws, std::size_t n_iter,
+                  std::size_t n_chains){
+
+  split_chains sc(draws, n_iter, n_chains);
+  if(sc.N < 2 or sc.W <= 0.0){
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+
+  const std::size_t N = sc.N;
+  const std::size_t M = sc.M;
+  const std::size_t offset = n_iter - 2 * N;
+
+  // rho_t = 1 - (W - mean_m acov_m(t)) / var_plus
+  std::vector<double> rho;
+  rho.reserve(N);
+  for(std::size_t lag = 0; lag < N; ++lag){
+    double acov = 0.0;
+    for(std::size_t m = 0; m < M; ++m){
+      const double *x = sc.half(draws, n_iter, offset, m);
+      double s = 0.0;
+      for(std::size_t t = 0; t + lag < N; ++t){
+        s += (x[t] - sc.mean[m]) * (x[t + lag] - sc.mean[m]);
+      }
+      acov += s / N;
+    }
+    acov /= M;
+    rho.push_back(1.0 - (sc.W - acov) / sc.var_plus);
+
+    // Geyer: stop once the sum of an adjacent pair becomes negative
+    if(lag % 2 == 1 and rho[lag - 1] + rho[lag] < 0.0){
+      rho.pop_back();
+      rho.pop_back();
+      break;
+    }
+  }
+
+  double tau = -1.0;
+  for(std::size_t lag = 0; lag < rho.size(); ++lag){
+    tau += 2.0 * rho[lag];
+  }
+  if(tau <= 0.0){
+    tau = 1.0 / std::log10(static_cast<double>(M * N));
+  }
+
+  return M * N / tau;
+
+}
+
+#endif
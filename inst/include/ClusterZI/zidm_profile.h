@@ -0,0 +1,78 @@
+#ifndef CLUSTERZI_ZIDM_PROFILE_H
+#define CLUSTERZI_ZIDM_PROFILE_H
+
+#include <chrono>
+
+/* Per-step profile of a chain.
+ *
+ * run_chain() only touches the profile when it is requested: every update
+ * step then reads the clock before and after it (two steady_clock reads,
+ * about 50 ns, per step and iteration), and the moves count their
+ * proposals and acceptances. For the at-risk step, a proposal is one
+ * indicator draw and an acceptance is an indicator that changes; for
+ * beta, one MH proposal (one cluster, or one block of taxa); for the
+ * split-merge, one proposal, split and merge apart. "output" covers the
+ * recording of the traces, the checkpoints and the printing, and "total"
+ * the whole run.
+ */
+
+enum profile_step {
+  prof_at_risk = 0,
+  prof_beta = 1,
+  prof_realloc = 2,
+  prof_split = 3,
+  prof_merge = 4,
+  prof_tau = 5,
+  prof_output = 6,
+  prof_total = 7,
+  n_prof_steps = 8
+};
+
+static const char *const profile_names[n_prof_steps] = {
+  "at_risk", "beta", "realloc", "split", "merge", "tau", "output", "total"
+};
+
+typedef std::chrono::steady_clock profile_clock;
+
+struct chain_profile {
+
+  bool on;
+  double seconds[n_prof_steps];
+  double calls[n_prof_steps];
+  double proposed[n_prof_steps];
+  double accepted[n_prof_steps];
+
+  chain_profile(bool on_ = false): on(on_) {
+    for(int s = 0; s < n_prof_steps; ++s){
+      seconds[s] = 0.0;
+      calls[s] = 0.0;
+      proposed[s] = 0.0;
+      accepted[s] = 0.0;
+    }
+  }
+
+  // One call of step, which started at since
+  void add(int step, const profile_clock::time_point &since){
+    std::chrono::duration<double> elapsed = profile_clock::now() - since;
+    seconds[step] += elapsed.count();
+    calls[step] += 1;
+  }
+
+  void count(int step, double n_proposed, double n_accepted){
+    proposed[step] += n_proposed;
+    accepted[step] += n_accepted;
+  }
+
+  // Sum of the profiles of several chains
+  void merge(const chain_profile &other){
+    for(int s = 0; s < n_prof_steps; ++s){
+      seconds[s] += other.seconds[s];
+      calls[s] += other.calls[s];
+      proposed[s] += other.proposed[s];
+      accepted[s] += other.accepted[s];
+    }
+  }
+
+};
+
+#endif
@@ -0,0 +1,400 @@
+#ifndef CLUSTERZI_ZIDM_PSM_H
+#define CLUSTERZI_ZIDM_PSM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <armadillo>
+
+/* Posterior similarity matrix (PSM) accumulated during the run, and a point
+ * estimate of the clustering from it.
+ *
+ * psm_accum counts, for every pair i < j, the kept iterations where i and j
+ * share a cluster. The counts are a packed upper triangle, row after row,
+ * which is also the order of an R "dist" object. The labels of the kept
+ * iterations are buffered, batch_size at a time with the labels of a sample
+ * next to each other, and a full batch is added tile by tile over the
+ * triangle: every count is then read and written once per batch rather
+ * than once per iteration, and the comparisons of a pair run over
+ * contiguous labels.
+ *
+ * psm_point() minimizes the posterior expected Binder loss (equal costs),
+ * or the lower bound of the expected variation of information of Wade and
+ * Ghahramani (2018), which are both functions of the PSM, by moving one
+ * sample at a time to its best cluster (or a new one) until no move lowers
+ * the loss. It starts from the given labels and from one cluster, and keeps
+ * the better result.
+ *
+ * write_psm_bin() writes the probabilities to a file (host byte order):
+ *
+ *   header   magic "CZIPSM\0\0", then uint32 version and draws, uint64 n
+ *   values   the n (n - 1) / 2 probabilities as float, in the order above
+ */
+
+static const char psm_magic[8] = {'C', 'Z', 'I', 'P', 'S', 'M', '\0', '\0'};
+static const std::uint32_t psm_version = 1;
+
+struct psm_file_header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t n_draws;
+  std::uint64_t n;
+};
+
+enum point_loss {
+  loss_none = -1,
+  loss_binder = 0,
+  loss_vi = 1
+};
+
+inline int point_loss_type(const std::string &loss){
+  if(loss == "binder"){
+    return loss_binder;
+  } else if(loss == "VI"){
+    return loss_vi;
+  } else if(loss != "none"){
+    throw std::invalid_argument(
+      "point_loss must be \"binder\", \"VI\" or \"none\".");
+  }
+  return loss_none;
+}
+
+inline std::size_t psm_offset(std::size_t n, std::size_t i){
+  // Position of the pair (i, i + 1) in the packed triangle
+  return i * (2 * n - i - 1) / 2;
+}
+
+inline std::size_t psm_index(std::size_t n, std::size_t i, std::size_t j){
+  // Position of the pair (i, j), i != j
+  return (i < j) ? psm_offset(n, i) + (j - i - 1) :
+    psm_offset(n, j) + (i - j - 1);
+}
+
+struct psm_accum {
+
+  enum { batch_size = 64, tile = 64 };
+
+  unsigned int n;                       // 0 when not accumulated
+  std::uint32_t n_draws;
+  std::vector<std::uint32_t> count;     // pairs i < j, row after row
+  std::vector<std::uint16_t> batch;     // n x batch_size pending labels
+  unsigned int n_batch;
+
+  psm_accum(): n(0), n_draws(0), n_batch(0) {}
+
+  void init(unsigned int n_, unsigned int K_max){
+    if(K_max > 65536){
+      throw std::invalid_argument("the PSM needs K_max <= 65536.");
+    }
+    n = n_;
+    n_draws = 0;
+    n_batch = 0;
+    count.assign(psm_offset(n, n), 0);
+    batch.assign(static_cast<std::size_t>(n) * batch_size, 0);
+  }
+
+  void add(const arma::uvec &assign){
+    for(unsigned int i = 0; i < n; ++i){
+      batch[static_cast<std::size_t>(i) * batch_size + n_batch] = assign[i];
+    }
+    n_batch += 1;
+    n_draws += 1;
+    if(n_batch == batch_size){
+      flush();
+    }
+  }
+
+  // Add the pending labels to the counts
+  void flush(){
+    if(n_batch == 0){
+      return;
+    }
+    const unsigned int B = n_batch;
+    for(unsigned int i0 = 0; i0 < n; i0 += tile){
+      unsigned int i1 = std::min(i0 + (unsigned int)tile, n);
+      for(unsigned int j0 = i0; j0 < n; j0 += tile){
+        unsigned int j1 = std::min(j0 + (unsigned int)tile, n);
+        for(unsigned int i = i0; i < i1; ++i){
+          const std::uint16_t *li = &batch[static_cast<std::size_t>(i) *
+                                           batch_size];
+          // Pair (i, j) is count[base + j]; base wraps around for i = 0
+          const std::size_t base = psm_offset(n, i) - (i + 1);
+          for(unsigned int j = std::max(j0, i + 1); j < j1; ++j){
+            const std::uint16_t *lj = &batch[static_cast<std::size_t>(j) *
+                                             batch_size];
+            std::uint32_t same = 0;
+            for(unsigned int b = 0; b < B; ++b){
+              same += (li[b] == lj[b]);
+            }
+            count[base + j] += same;
+          }
+        }
+      }
+    }
+    n_batch = 0;
+  }
+
+  // Sum of the counts of another chain on the same samples
+  void merge(const psm_accum &other){
+    for(std::size_t e = 0; e < count.size(); ++e){
+      count[e] += other.count[e];
+    }
+    n_draws += other.n_draws;
+  }
+
+  // Co-clustering probabilities of the pairs, in the order of count
+  std::vector<float> probabilities() const {
+    std::vector<float> prob(count.size());
+    const double scale = (n_draws > 0) ? 1.0 / n_draws : 0.0;
+    for(std::size_t e = 0; e < count.size(); ++e){
+      prob[e] = count[e] * scale;
+    }
+    return prob;
+  }
+
+};
+
+inline std::vector<unsigned int> relabel(const std::vector<unsigned int> &x){
+
+  /* Labels 0, 1, ... in the order of the first sample of every cluster */
+
+  const unsigned int none = (unsigned int)-1;
+  std::vector<unsigned int> map, out(x.size());
+  unsigned int K = 0;
+  for(std::size_t i = 0; i < x.size(); ++i){
+    if(x[i] >= map.size()){
+      map.resize(x[i] + 1, none);
+    }
+    if(map[x[i]] == none){
+      map[x[i]] = K;
+      K += 1;
+    }
+    out[i] = map[x[i]];
+  }
+  return out;
+
+}
+
+inline double psm_loss(const std::vector<float> &prob, unsigned int n,
+                       const std::vector<unsigned int> &labels, int loss){
+
+  /* Expected Binder loss, or the lower bound of the expected VI (base 2),
+   * of the clustering labels */
+
+  if(loss == loss_binder){
+    double value = 0.0;
+    for(unsigned int i = 0; i < n; ++i){
+      const std::size_t base = psm_offset(n, i) - (i + 1);
+      for(unsigned int j = i + 1; j < n; ++j){
+        double p = prob[base + j];
+        value += (labels[i] == labels[j]) ? 1.0 - p : p;
+      }
+    }
+    return value;
+  }
+  std::vector<double> size(n, 0.0), s(n, 1.0), r(n, 1.0);
+  for(unsigned int i = 0; i < n; ++i){
+    size[labels[i]] += 1;
+  }
+  for(unsigned int i = 0; i < n; ++i){
+    const std::size_t base = psm_offset(n, i) - (i + 1);
+    for(unsigned int j = i + 1; j < n; ++j){
+      double p = prob[base + j];
+      r[i] += p;
+      r[j] += p;
+      if(labels[i] == labels[j]){
+        s[i] += p;
+        s[j] += p;
+      }
+    }
+  }
+  double value = 0.0;
+  for(unsigned int i = 0; i < n; ++i){
+    value += std::log2(size[labels[i]]) - 2 * std::log2(s[i]) +
+      std::log2(r[i]);
+  }
+  return value / n;
+
+}
+
+inline double psm_search(const std::vector<float> &prob, unsigned int n,
+                         int loss, unsigned int max_k,
+                         std::vector<unsigned int> &labels){
+
+  /* Local search from labels (0, ..., K - 1 with K <= max_k), in place;
+   * returns the loss of the result. For sample i, T[k] is the sum of
+   * 1 - 2 p_ij (Binder) over the other samples j of cluster k; for VI, s_j
+   * is the sum of p_jl over the cluster of j (p_jj = 1), G[k] the change of
+   * sum log s_j over cluster k when i joins it, and P[k] the sum of p_ij
+   * over cluster k. */
+
+  const unsigned int cap = std::max(max_k, n);
+  std::vector<double> size(cap, 0.0), T(cap), G(cap), P(cap), s(n, 1.0);
+  unsigned int n_clus = 0;
+  for(unsigned int i = 0; i < n; ++i){
+    n_clus += (size[labels[i]] == 0);
+    size[labels[i]] += 1;
+  }
+  if(loss == loss_vi){
+    for(unsigned int i = 0; i < n; ++i){
+      const std::size_t base = psm_offset(n, i) - (i + 1);
+      for(unsigned int j = i + 1; j < n; ++j){
+        if(labels[i] == labels[j]){
+          double p = prob[base + j];
+          s[i] += p;
+          s[j] += p;
+        }
+      }
+    }
+  }
+
+  for(unsigned int sweep = 0; sweep < 100; ++sweep){
+    bool moved = false;
+    for(unsigned int i = 0; i < n; ++i){
+
+      const unsigned int cur = labels[i];
+      std::fill(T.begin(), T.end(), 0.0);
+      std::fill(G.begin(), G.end(), 0.0);
+      std::fill(P.begin(), P.end(), 0.0);
+      double R = 0.0;   // change of sum log s_j over cur when i leaves
+      for(unsigned int j = 0; j < n; ++j){
+        if(j == i){
+          continue;
+        }
+        double p = prob[psm_index(n, i, j)];
+        unsigned int k = labels[j];
+        if(loss == loss_binder){
+          T[k] += 1.0 - 2.0 * p;
+        } else if(k == cur){
+          R += std::log(s[j] - p) - std::log(s[j]);
+        } else {
+          G[k] += std::log(s[j] + p) - std::log(s[j]);
+          P[k] += p;
+        }
+      }
+
+      // Best cluster; a new one is the first empty label
+      unsigned int best = cur;
+      double best_delta = -1e-10;
+      unsigned int empty = cap;
+      if((size[cur] > 1) and (n_clus < max_k)){
+        empty = std::find(size.begin(), size.end(), 0.0) - size.begin();
+      }
+      double a = size[cur];
+      double leave = (a - 1) * std::log(a - 1 > 0 ? a - 1 : 1) -
+        a * std::log(a);
+      for(unsigned int k = 0; k < cap; ++k){
+        if((k == cur) or ((size[k] == 0) and (k != empty))){
+          continue;
+        }
+        double delta;
+        if(loss == loss_binder){
+          delta = T[k] - T[cur];
+        } else {
+          double b = size[k];
+          double join = (b + 1) * std::log(b + 1) -
+            (b > 0 ? b * std::log(b) : 0.0);
+          delta = leave + join -
+            2 * (R + G[k] + std::log(1 + P[k]) - std::log(s[i]));
+        }
+        if(delta < best_delta){
+          best_delta = delta;
+          best = k;
+        }
+      }
+      if(best == cur){
+        continue;
+      }
+
+      // Move i from cur to best
+      if(loss == loss_vi){
+        for(unsigned int j = 0; j < n; ++j){
+          if(j == i){
+            continue;
+          }
+          double p = prob[psm_index(n, i, j)];
+          if(labels[j] == cur){
+            s[j] -= p;
+          } else if(labels[j] == best){
+            s[j] += p;
+          }
+        }
+        s[i] = 1 + P[best];
+      }
+      n_clus += (size[best] == 0);
+      size[cur] -= 1;
+      size[best] += 1;
+      n_clus -= (size[cur] == 0);
+      labels[i] = best;
+      moved = true;
+
+    }
+    if(not moved){
+      break;
+    }
+  }
+
+  labels = relabel(labels);
+  return psm_loss(prob, n, labels, loss);
+
+}
+
+inline std::vector<unsigned int> psm_point(const psm_accum &psm, int loss,
+                                           unsigned int max_k,
+                                           const arma::uvec &init){
+
+  /* Point estimate of the clustering, labels 0, ..., K - 1 with K <= max_k
+   * numbered by the first sample of every cluster, from the local searches
+   * started at init and at one cluster */
+
+  const unsigned int n = psm.n;
+  if(psm.n_draws == 0){
+    throw std::invalid_argument("the PSM has no draw.");
+  }
+  std::vector<float> prob = psm.probabilities();
+
+  std::vector<unsigned int> from_init(init.begin(), init.end());
+  from_init = relabel(from_init);
+  unsigned int K_init = 0;
+  for(unsigned int i = 0; i < n; ++i){
+    K_init = std::max(K_init, from_init[i] + 1);
+  }
+  double loss_init = psm_search(prob, n, loss, std::max(max_k, K_init),
+                                from_init);
+
+  std::vector<unsigned int> from_one(n, 0);
+  double loss_one = psm_search(prob, n, loss, max_k, from_one);
+
+  return (loss_one < loss_init) ? from_one : from_init;
+
+}
+
+inline void write_psm_bin(const std::string &path, const psm_accum &psm){
+
+  psm_file_header header;
+  std::memcpy(header.magic, psm_magic, 8);
+  header.version = psm_version;
+  header.n_draws = psm.n_draws;
+  header.n = psm.n;
+  std::vector<float> prob = psm.probabilities();
+  std::FILE *f = std::fopen(path.c_str(), "wb");
+  if(f == NULL){
+    throw std::runtime_error("cannot open " + path);
+  }
+  bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1 and
+    (prob.empty() or
+       std::fwrite(&prob[0], sizeof(float), prob.size(), f) == prob.size());
+  ok = (std::fclose(f) == 0) and ok;
+  if(not ok){
+    throw std::runtime_error("cannot write " + path);
+  }
+
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef CLUSTERZI_ZIDM_RNG_H
+#define CLUSTERZI_ZIDM_RNG_H
+
+#include <cmath>
+#include <cstdint>
+
+/* Counter-based random streams.
+ *
+ * R's generator is global and cannot be used from several threads. Instead,
+ * every unit of work (one sample in the at-risk update, one cluster in the
+ * beta update, one split-merge proposal, ...) gets its own xoshiro256**
+ * stream whose state is derived from a key: the seed, the chain, the
+ * iteration, the update step and the index of the unit. The draws of a unit
+ * only depend on its key, so a chain is the same whether it runs on one or
+ * many threads, and it can be restarted at any iteration.
+ */
+
+inline std::uint64_t mix64(std::uint64_t x){
+
+  /* splitmix64 finalizer */
+
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// The update steps of one iteration; each one has its own family of streams.
+enum rng_step {
+  step_init = 0,
+  step_at_risk = 1,
+  step_beta = 2,
+  step_realloc = 3,
+  step_sm = 4,
+  step_tau = 5,
+  step_predict = 6
+};
+
+struct rng_key {
+
+  std::uint64_t seed;
+  std::uint64_t chain;
+
+  rng_key(std::uint64_t seed_ = 0, std::uint64_t chain_ = 0):
+    seed(seed_), chain(chain_) {}
+
+};
+
+class rng_stream {
+
+public:
+
+  rng_stream(const rng_key &key, std::uint64_t iter, rng_step step,
+             std::uint64_t index = 0): has_spare(false), spare(0.0) {
+    std::uint64_t h = mix64(key.seed);
+    h = mix64(h ^ key.chain);
+    h = mix64(h ^ iter);
+    h = mix64(h ^ static_cast<std::uint64_t>(step));
+    h = mix64(h ^ index);
+    for(int r = 0; r < 4; ++r){
+      h = mix64(h);
+      s[r] = h;
+    }
+  }
+
+  std::uint64_t next(){
+    const std::uint64_t result = rotl(s[1] * 5, 7) * 9;
+    const std::uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+  }
+
+  // Uniform on the open interval (0, 1)
+  double unif(){
+    return ((next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+  }
+
+  // Uniform integer in {0, ..., n - 1}
+  unsigned int index(unsigned int n){
+    return static_cast<unsigned int>(((next() >> 32) *
+                                      static_cast<std::uint64_t>(n)) >> 32);
+  }
+
+  // Standard normal (Marsaglia's polar method)
+  double norm(){
+    if(has_spare){
+      has_spare = false;
+      return spare;
+    }
+    double u, v, r2;
+    do {
+      u = 2.0 * unif() - 1.0;
+      v = 2.0 * unif() - 1.0;
+      r2 = u * u + v * v;
+    } while(r2 >= 1.0);
+    double m = std::sqrt(-2.0 * std::log(r2) / r2);
+    spare = v * m;
+    has_spare = true;
+    return u * m;
+  }
+
+  // Gamma(shape, scale) (Marsaglia and Tsang)
+  double gamma(double shape, double scale){
+    if(shape <= 0.0){
+      return 0.0;
+    }
+    if(shape < 1.0){
+      double u = unif();
+      return gamma(shape + 1.0, scale) * std::pow(u, 1.0 / shape);
+    }
+    double d = shape - 1.0/3.0;
+    double c = 1.0/std::sqrt(9.0 * d);
+    for(;;){
+      double x, v;
+      do {
+        x = norm();
+        v = 1.0 + c * x;
+      } while(v <= 0.0);
+      v = v * v * v;
+      double u = unif();
+      if(u < 1.0 - 0.0331 * x * x * x * x){
+        return d * v * scale;
+      }
+      if(std::log(u) < 0.5 * x * x + d * (1.0 - v + std::log(v))){
+        return d * v * scale;
+      }
+    }
+  }
+
+  // One draw from the categorical distribution with (unnormalized) prob
+  unsigned int categorical(const double *prob, unsigned int K){
+    double total = 0.0;
+    for(unsigned int k = 0; k < K; ++k){
+      total += prob[k];
+    }
+    return categorical(prob, K, total);
+  }
+
+  // Same, when the sum of prob is already known
+  unsigned int categorical(const double *prob, unsigned int K, double total){
+    double u = unif() * total;
+    double cum = 0.0;
+    for(unsigned int k = 0; k + 1 < K; ++k){
+      cum += prob[k];
+      if(u < cum){
+        return k;
+      }
+    }
+    return K - 1;
+  }
+
+private:
+
+  std::uint64_t s[4];
+  bool has_spare;
+  double spare;
+
+  static std::uint64_t rotl(std::uint64_t x, int k){
+    return (x << k) | (x >> (64 - k));
+  }
+
+};
+
+#endif
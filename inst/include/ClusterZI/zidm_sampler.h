@@ -0,0 +1,1015 @@
+#ifndef CLUSTERZI_ZIDM_SAMPLER_H
+#define CLUSTERZI_ZIDM_SAMPLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <armadillo>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "zidm_cache.h"
+#include "zidm_data.h"
+#include "zidm_rng.h"
+#include "zidm_simd.h"
+
+/* Update kernels of the samplers: the at-risk indicators, beta, the labels
+ * (sequential and blocked reallocation), the split-merge move and tau.
+ *
+ * The kernels only use Armadillo, the headers of this directory and the
+ * counter-based streams, so they are shared by the R interface
+ * (src/clusterZI.cpp, which includes RcppArmadillo.h first) and by programs
+ * built without R (see zidm_api.h and bench/). The exported R functions of
+ * the same names are thin wrappers in src/clusterZI.cpp.
+ */
+
+inline zidm_data make_data(const arma::mat &z){
+  
+  /* Build the sparse count table (see zidm_data.h) from the n x p counts */
+  
+  return zidm_data(z.memptr(), z.n_rows, z.n_cols);
+  
+}
+
+inline clus_cache make_cache(const arma::mat &beta_mat, const zidm_data &data){
+  
+  /* Build the per-cluster cache, with the rising factorial tables, from 
+     every row of the beta matrix. */
+  
+  clus_cache cache(beta_mat.n_rows);
+  for(unsigned int k = 0; k < beta_mat.n_rows; ++k){
+    cache[k].set(beta_mat.memptr() + k, beta_mat.n_cols, beta_mat.n_rows);
+    cache[k].tabulate(data.rise_ptr);
+  }
+  return cache;
+  
+}
+
+inline double exp_weights(double *log_unnorm_prob, unsigned int K){
+  
+  /* Replace the K log weights by exp(log weight - max) in place, with one
+     batched exp(), and return their sum. As in log_sum_exp(), a weight more
+     than log(1e20 K) below the largest one is set to 1e-20. */
+  
+  double max_elem = log_unnorm_prob[0];
+  for(unsigned int k = 1; k < K; ++k){
+    max_elem = std::max(max_elem, log_unnorm_prob[k]);
+  }
+  double t = std::log(0.00000000000000000001 / K);
+  
+  // Move the weights at or below t to t - 1, below floor_prob after the exp()
+  for(unsigned int k = 0; k < K; ++k){
+    log_unnorm_prob[k] -= max_elem;
+    if(log_unnorm_prob[k] <= t){
+      log_unnorm_prob[k] = t - 1;
+    }
+  }
+  vexp(log_unnorm_prob, K);
+  
+  // exp(t - 1/2)
+  double floor_prob = 0.00000000000000000001 / K * 0.6065306597126334;
+  double total = 0.0;
+  for(unsigned int k = 0; k < K; ++k){
+    if(log_unnorm_prob[k] < floor_prob){
+      log_unnorm_prob[k] = 0.00000000000000000001;
+    }
+    total += log_unnorm_prob[k];
+  }
+  return total;
+  
+}
+
+inline void log_sum_exp(double *log_unnorm_prob, unsigned int K){
+  
+  /* Same as log_sum_exp(), but normalizes the K weights in place */
+  
+  double total = exp_weights(log_unnorm_prob, K);
+  for(unsigned int k = 0; k < K; ++k){
+    log_unnorm_prob[k] /= total;
+  }
+  
+}
+
+inline unsigned int log_categorical(double *log_prob, unsigned int K, 
+                                    rng_stream &rng){
+  
+  /* One draw from the categorical distribution with (unnormalized) log 
+     weights log_prob, which is used as the buffer of the weights. The 
+     weights are not normalized: the uniform is scaled by their sum. */
+  
+  double total = exp_weights(log_prob, K);
+  return rng.categorical(log_prob, K, total);
+  
+}
+
+struct sampler_work {
+  
+  /* Buffers of the update kernels. They are allocated once per chain, so
+     that an iteration does not allocate anything. */
+  
+  arma::vec nk;                   // cluster sizes
+  std::vector<unsigned int> active;   // active clusters, in increasing order
+  unsigned int n_active;
+  arma::vec log_prob;             // reallocation weights
+  std::vector<double> lgamma_buf; // batched marginals, 2 K
+  arma::mat beta_prop;            // MH proposals of beta
+  clus_cache stat_prop;           // cache of the proposals
+  arma::vec logA;                 // MH log-ratio of every cluster
+  arma::vec logU;
+  std::vector<unsigned int> S;    // split-merge set
+  arma::uvec launch_assign;
+  arma::uvec proposed_assign;
+  arma::vec launch_tau;
+  arma::vec proposed_tau;
+  arma::mat launch_beta;
+  arma::mat proposed_beta;
+  arma::vec nk_proposed;
+  std::vector<double> thread_buf; // per-thread weights of the blocked realloc
+  std::vector<double> sm_marg;    // marginals of S in the two SM clusters
+  
+  sampler_work(unsigned int n, unsigned int p, unsigned int K):
+    nk(K), active(K), n_active(0), log_prob(K), lgamma_buf(2 * K),
+    beta_prop(K, p, arma::fill::zeros), stat_prop(K), logA(K), logU(K),
+    launch_assign(n), proposed_assign(n), launch_tau(K), proposed_tau(K),
+    launch_beta(K, p), proposed_beta(K, p), nk_proposed(K) {
+    S.reserve(n);
+    sm_marg.reserve(2 * n);
+    for(unsigned int k = 0; k < K; ++k){
+      stat_prop[k].set(beta_prop.memptr() + k, p, K);
+    }
+  }
+  
+  // Cluster sizes and the list of active clusters
+  void count(const arma::uvec &clus_assign){
+    nk.zeros();
+    for(unsigned int i = 0; i < clus_assign.n_elem; ++i){
+      nk[clus_assign[i]] += 1;
+    }
+    n_active = 0;
+    for(unsigned int k = 0; k < nk.n_elem; ++k){
+      if(nk[k] > 0){
+        active[n_active++] = k;
+      }
+    }
+  }
+  
+};
+
+struct beta_adapt {
+  
+  /* Scales of the beta proposals. beta_kj moves by exp(log_scale[k]) sd[j]
+     times a standard normal draw; at the start, log_scale is 0 and sd is the
+     fixed sd of the MH_var proposal. While adapting (the burn-in), 
+     log_scale[k] follows a Robbins-Monro recursion towards an acceptance 
+     rate of 0.234, and sd[j] becomes 2.38 / sqrt(d) times the pooled 
+     within-cluster sd of beta_.j once it is based on min_df draws, where d
+     is the number of taxa proposed jointly (p, or the block size). The 
+     scales are fixed afterwards, so the kept draws come from a fixed MH 
+     kernel. */
+  
+  arma::vec log_scale;   // per cluster
+  arma::vec sd;          // per taxon
+  arma::vec n_adapt;     // adaptation steps of every cluster
+  arma::vec n_mom;       // draws in the moments of every cluster
+  arma::mat mean;        // running mean and sum of squares of beta_kj
+  arma::mat m2;
+  arma::vec tried;       // proposals and acceptances of every cluster
+  arma::vec accepted;
+  
+  beta_adapt() {}
+  
+  beta_adapt(unsigned int K, unsigned int p, double s2_MH):
+    log_scale(K, arma::fill::zeros), sd(p), n_adapt(K, arma::fill::zeros),
+    n_mom(K, arma::fill::zeros), mean(K, p, arma::fill::zeros), 
+    m2(K, p, arma::fill::zeros), tried(K, arma::fill::zeros), 
+    accepted(K, arma::fill::zeros) {
+    // The proposal covariance of MH_var is I * sqrt(s2_MH)
+    sd.fill(std::sqrt(std::sqrt(s2_MH)));
+  }
+  
+  // One adaptation step of cluster k after its MH step; accept is the 
+  // fraction of accepted proposals (of the blocks of beta_k)
+  void step(unsigned int k, double accept, const arma::mat &beta_mat){
+    n_adapt[k] += 1;
+    log_scale[k] += std::pow(n_adapt[k], -0.6) * (accept - 0.234);
+    n_mom[k] += 1;
+    if(n_mom[k] == 1){
+      mean.row(k) = beta_mat.row(k);
+      m2.row(k).zeros();
+      return;
+    }
+    for(unsigned int j = 0; j < beta_mat.n_cols; ++j){
+      double delta = beta_mat(k, j) - mean(k, j);
+      mean(k, j) += delta / n_mom[k];
+      m2(k, j) += delta * (beta_mat(k, j) - mean(k, j));
+    }
+  }
+  
+  // A new cluster k does not continue the moments of the previous one
+  void restart(unsigned int k){
+    n_mom[k] = 0;
+  }
+  
+  // Pooled within-cluster sd of every taxon
+  void refresh_sd(unsigned int dim, double min_df = 100){
+    double df = 0.0;
+    for(unsigned int k = 0; k < n_mom.n_elem; ++k){
+      df += (n_mom[k] >= 2) ? (n_mom[k] - 1) : 0.0;
+    }
+    if(df < min_df){
+      return;
+    }
+    double factor = 2.38 / std::sqrt((double)dim);
+    for(unsigned int j = 0; j < sd.n_elem; ++j){
+      double ss = 0.0;
+      for(unsigned int k = 0; k < n_mom.n_elem; ++k){
+        ss += (n_mom[k] >= 2) ? m2(k, j) : 0.0;
+      }
+      sd[j] = std::max(factor * std::sqrt(ss / df), 1e-3);
+    }
+  }
+  
+  // Acceptance rate of every cluster since the last reset (NaN if never 
+  // proposed)
+  arma::vec accept_rate() const {
+    return accepted / tried;
+  }
+  
+  void reset_counts(){
+    tried.zeros();
+    accepted.zeros();
+  }
+  
+};
+
+inline void adjust_tau_beta(const arma::vec &nk, arma::vec &tau_vec,
+                            arma::mat &beta_mat){
+  
+  /* Same as adjust_tau_beta(), given the cluster sizes nk */
+  
+  for(unsigned int k = 0; k < tau_vec.n_elem; ++k){
+    if(nk[k] == 0){
+      tau_vec[k] = 0.0;
+      beta_mat.row(k).zeros();
+    }
+  }
+  
+}
+
+inline void sm_marginals(const zidm_data &data, const at_risk_vec &gamma,
+                         const clus_cache &cache,
+                         const std::vector<unsigned int> &S,
+                         const unsigned int *clus_sm, unsigned int n_threads,
+                         std::vector<double> &marg){
+  
+  /* marg[2 ss + kk] is the marginal of sample S[ss] in cluster clus_sm[kk].
+     beta does not change during a split-merge proposal, so these 2 |S| 
+     values serve every launch sweep, the proposal densities and the MH 
+     ratio. The samples are independent, so they run on n_threads threads. */
+  
+  const int n_S = S.size();
+  marg.resize(2 * n_S);
+  
+  #pragma omp parallel for num_threads(n_threads) schedule(static) if(n_S > 256)
+  for(int ss = 0; ss < n_S; ++ss){
+    double buf[4];
+    log_marginal(data, S[ss], gamma, cache, clus_sm, 2, &marg[2 * ss], buf);
+  }
+  
+}
+
+inline void realloc_sm(arma::uvec &clus_assign,
+                       const std::vector<unsigned int> &S,
+                       const unsigned int *clus_sm,
+                       const std::vector<double> &marg, rng_stream &rng){
+  
+  /* Reallocation algorithm for the split merge, in place. clus_sm holds the
+     two clusters of the proposal and marg the marginals of S in them (see 
+     sm_marginals). */
+  
+  double nk[2] = {0.0, 0.0};
+  
+  for(unsigned int ss = 0; ss < S.size(); ++ss){
+    nk[clus_assign[S[ss]] != clus_sm[0]] += 1;
+  }
+  
+  for(unsigned int ss = 0; ss < S.size(); ++ss){
+    
+    unsigned int s = S[ss];
+    nk[clus_assign[s] != clus_sm[0]] -= 1;
+    
+    double prob[2];
+    for(int kk = 0; kk <= 1; ++kk){
+      prob[kk] = marg[2 * ss + kk] + std::log(nk[kk]);
+    }
+    
+    unsigned int new_ck = log_categorical(prob, 2, rng);
+    
+    // New assign
+    clus_assign[s] = clus_sm[new_ck];
+    
+    nk[new_ck] += 1;
+    
+  }
+  
+}
+
+inline double log_proposal(const arma::uvec &clus_after,
+                           const arma::uvec &clus_before,
+                           const std::vector<unsigned int> &S,
+                           const unsigned int *clus_sm,
+                           const std::vector<double> &marg){
+  
+  /* Calculate the proposal probability, p(after|before), in a log scale */
+  
+  double log_val = 0.0;
+  
+  double nk[2] = {0.0, 0.0};
+  
+  for(unsigned int ss = 0; ss < S.size(); ++ss){
+    nk[clus_before[S[ss]] != clus_sm[0]] += 1;
+  }
+  
+  for(unsigned int ss = 0; ss < S.size(); ++ss){
+    unsigned int s = S[ss];
+    nk[clus_before[s] != clus_sm[0]] -= 1;
+    
+    // Calculate the reallocation probability
+    double prob[2];
+    for(int kk = 0; kk <= 1; ++kk){
+      prob[kk] = marg[2 * ss + kk] + std::log(nk[kk]);
+    }
+    
+    log_sum_exp(prob, 2);
+    unsigned int new_index = (clus_after[s] != clus_sm[0]);
+    log_val += std::log(prob[new_index]);
+    nk[new_index] += 1;
+  }
+  
+  return log_val;
+  
+}
+
+inline double log_beta(double a, double b){
+  return std::lgamma(a) + std::lgamma(b) - std::lgamma(a + b);
+}
+
+inline unsigned int update_at_risk_row(const zidm_data &data, unsigned int i, 
+                                       at_risk_vec &gamma, 
+                                       const clus_stat &stat, const double *lb, 
+                                       rng_stream &rng){
+  
+  /* Update the at-risk indicators of the zero counts of sample i, and return
+     the number of flips. Flipping 
+     gamma_ij of a zero count only changes the at-risk sum of xi_k (the count
+     itself adds lgamma(xi) - lgamma(xi) = 0), so we keep the running sum of 
+     xi_k over the at-risk taxa and evaluate each flip in constant time. The 
+     non-zero counts are always at risk, so the count sum is fixed. */
+  
+  const std::uint32_t begin = data.zero_ptr[i];
+  const std::uint32_t end = data.zero_ptr[i + 1];
+  
+  double sum_xi = stat.sum_xi;
+  for(std::uint32_t e = begin; e < end; ++e){
+    if(gamma[e] == 0){
+      sum_xi -= stat.xi[data.zero_col[e]];
+    }
+  }
+  const double sum_z = data.total[i];
+  double lm_current = std::lgamma(sum_xi) - std::lgamma(sum_xi + sum_z);
+  unsigned int n_flip = 0;
+  
+  for(std::uint32_t e = begin; e < end; ++e){
+    
+    double xi_j = stat.xi[data.zero_col[e]];
+    int gm_ij = gamma[e];
+    int pp_gm = 1 - gm_ij;
+    double sum_pp = (pp_gm == 1) ? (sum_xi + xi_j) : (sum_xi - xi_j);
+    double lm_pp = std::lgamma(sum_pp) - std::lgamma(sum_pp + sum_z);
+    
+    // Calculate logA
+    double logA = lb[pp_gm] - lb[gm_ij] + lm_pp - lm_current;
+    
+    // MH
+    double logU = std::log(rng.unif());
+    if(logU <= logA){
+      gamma[e] = pp_gm;
+      sum_xi = sum_pp;
+      lm_current = lm_pp;
+      n_flip += 1;
+    }
+    
+  }
+  
+  return n_flip;
+  
+}
+
+inline std::size_t update_at_risk(const zidm_data &data, 
+                                  const arma::uvec &clus_assign,
+                                  at_risk_vec &gamma, const clus_cache &cache,
+                                  double r0g, double r1g, const rng_key &key,
+                                  std::uint64_t iter, unsigned int n_threads){
+  
+  /* Update the at-risk indicators in place, and return the number of flips.
+     Given the cluster assignment and beta, the samples are independent, so 
+     they are updated in parallel, each thread on its own rows of the zero 
+     lists. Each sample draws from its own stream, which makes the result 
+     independent of the number of threads. */
+  
+  // lbeta(r0g + g, r1g + (1 - g)) for g = 0, 1
+  double lb[2] = {log_beta(r0g, r1g + 1), log_beta(r0g + 1, r1g)};
+  
+  const int n = data.n;
+  std::size_t n_flip = 0;
+  
+  #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 16) \
+    reduction(+:n_flip)
+  for(int i = 0; i < n; ++i){
+    rng_stream rng(key, iter, step_at_risk, i);
+    n_flip += update_at_risk_row(data, i, gamma, cache[clus_assign[i]], lb, 
+                                 rng);
+  }
+  
+  return n_flip;
+  
+}
+
+inline void update_beta(const zidm_data &data, const arma::uvec &clus_assign,
+                        const at_risk_vec &gamma, arma::mat &beta_mat,
+                        clus_cache &cache, double mu, double s2, beta_adapt &mh,
+                        bool adapt, const rng_key &key, std::uint64_t iter,
+                        sampler_work &work){
+  
+  /* Update the beta matrix in place. All active clusters propose at once, and
+     a single pass over the samples accumulates the MH ratios. The cache of
+     cluster k is swapped with the cache of its proposal on acceptance, and 
+     only then tabulated. The proposal scales are taken from mh, which also 
+     counts the acceptances, and are adapted when adapt is true. */
+  
+  const unsigned int p = data.p;
+  work.count(clus_assign);
+  for(unsigned int k = 0; k < work.nk.n_elem; ++k){
+    if(work.nk[k] == 0){
+      mh.restart(k);
+    }
+  }
+  
+  // Propose a new beta_k and its prior ratio
+  for(unsigned int kk = 0; kk < work.n_active; ++kk){
+    unsigned int k = work.active[kk];
+    rng_stream rng(key, iter, step_beta, k);
+    double scale = std::exp(mh.log_scale[k]);
+    
+    double log_prior = 0.0;
+    for(unsigned int j = 0; j < p; ++j){
+      double b = beta_mat(k, j);
+      double b_new = b + scale * mh.sd[j] * rng.norm();
+      work.beta_prop(k, j) = b_new;
+      log_prior += ((b - mu) * (b - mu) - (b_new - mu) * (b_new - mu)) / (2 * s2);
+    }
+    
+    work.logA[k] = log_prior;
+    work.logU[k] = std::log(rng.unif());
+    work.stat_prop[k].set(work.beta_prop.memptr() + k, p, work.beta_prop.n_rows);
+  }
+  
+  // Likelihood ratio
+  for(unsigned int i = 0; i < data.n; ++i){
+    unsigned int k = clus_assign[i];
+    work.logA[k] += log_marginal(data, i, gamma, work.stat_prop[k]);
+    work.logA[k] -= log_marginal(data, i, gamma, cache[k]);
+  }
+  
+  // MH
+  for(unsigned int kk = 0; kk < work.n_active; ++kk){
+    unsigned int k = work.active[kk];
+    bool accept = (work.logU[k] <= work.logA[k]);
+    if(accept){
+      beta_mat.row(k) = work.beta_prop.row(k);
+      std::swap(cache[k], work.stat_prop[k]);
+      cache[k].tabulate(data.rise_ptr);
+    }
+    mh.tried[k] += 1;
+    mh.accepted[k] += accept;
+    if(adapt){
+      mh.step(k, accept, beta_mat);
+    }
+  }
+  if(adapt){
+    mh.refresh_sd(p);
+  }
+  
+}
+
+struct beta_blocks {
+  
+  /* Partition of the taxa in blocks of size taxa for the blocked beta 
+     update, with its buffers. Block b is the taxa b size ... (b + 1) size - 1.
+     The entries of sample i in block b are nz_start[i (n_blk + 1) + b] ... 
+     nz_start[i (n_blk + 1) + b + 1] - 1 of the non-zero list, and likewise 
+     for the zero list; the lists are sorted by taxon. */
+  
+  unsigned int size;
+  unsigned int n_blk;
+  std::vector<std::uint32_t> nz_start;
+  std::vector<std::uint32_t> zero_start;
+  std::vector<unsigned int> member_ptr;   // samples by cluster
+  std::vector<unsigned int> members;
+  std::vector<double> at_risk_sum;        // sum of xi at risk, by sample
+  std::vector<double> sum_new;            // the same with the proposal
+  std::vector<double> beta_new;           // proposal of the block
+  std::vector<double> xi_new;
+  std::vector<double> lg_new;
+  std::vector<double> delta;              // xi_new - xi
+  std::vector<double> lg_plus;            // lgamma terms of the MH ratio
+  std::vector<double> lg_minus;
+  
+  beta_blocks(const zidm_data &data, unsigned int K, unsigned int size_):
+    size(size_), n_blk((data.p + size_ - 1) / size_),
+    nz_start(static_cast<std::size_t>(data.n) * (n_blk + 1)),
+    zero_start(static_cast<std::size_t>(data.n) * (n_blk + 1)),
+    member_ptr(K + 1), members(data.n), at_risk_sum(data.n), 
+    sum_new(data.n), beta_new(size_), xi_new(size_), lg_new(size_), 
+    delta(size_) {
+    const std::uint32_t *nz = &data.nz_col[0];
+    const std::uint32_t *zero = &data.zero_col[0];
+    for(unsigned int i = 0; i < data.n; ++i){
+      for(unsigned int b = 0; b <= n_blk; ++b){
+        std::uint32_t j = std::min(b * size, data.p);
+        std::size_t r = static_cast<std::size_t>(i) * (n_blk + 1) + b;
+        nz_start[r] = std::lower_bound(nz + data.nz_ptr[i], 
+                                       nz + data.nz_ptr[i + 1], j) - nz;
+        zero_start[r] = std::lower_bound(zero + data.zero_ptr[i], 
+                                         zero + data.zero_ptr[i + 1], j) - zero;
+      }
+    }
+  }
+  
+  // Group the samples by cluster, given the cluster sizes nk
+  void group(const arma::uvec &clus_assign, const arma::vec &nk){
+    member_ptr[0] = 0;
+    for(unsigned int k = 0; k < nk.n_elem; ++k){
+      member_ptr[k + 1] = member_ptr[k] + nk[k];
+    }
+    std::vector<unsigned int> next(member_ptr.begin(), member_ptr.end() - 1);
+    for(unsigned int i = 0; i < clus_assign.n_elem; ++i){
+      members[next[clus_assign[i]]++] = i;
+    }
+  }
+  
+};
+
+inline void update_beta_blocked(const zidm_data &data,
+                                const arma::uvec &clus_assign,
+                                const at_risk_vec &gamma, arma::mat &beta_mat,
+                                clus_cache &cache, double mu, double s2,
+                                beta_adapt &mh, bool adapt, const rng_key &key,
+                                std::uint64_t iter, sampler_work &work,
+                                beta_blocks &blk){
+  
+  /* Same as update_beta(), but beta_k is updated one block of taxa at a 
+     time, each with its own MH step. The sum of xi_k at risk of every 
+     sample is cached, so the MH ratio of a block only visits the entries of
+     the cluster's samples in the block: the non-zero counts of the block 
+     and the zero counts that are not at risk. The cache of cluster k is 
+     refreshed once its blocks are done. */
+  
+  const unsigned int p = data.p;
+  work.count(clus_assign);
+  for(unsigned int k = 0; k < work.nk.n_elem; ++k){
+    if(work.nk[k] == 0){
+      mh.restart(k);
+    }
+  }
+  blk.group(clus_assign, work.nk);
+  for(unsigned int i = 0; i < data.n; ++i){
+    blk.at_risk_sum[i] = at_risk_xi(data, i, gamma, cache[clus_assign[i]]);
+  }
+  
+  for(unsigned int kk = 0; kk < work.n_active; ++kk){
+    unsigned int k = work.active[kk];
+    rng_stream rng(key, iter, step_beta, k);
+    double scale = std::exp(mh.log_scale[k]);
+    const clus_stat &stat = cache[k];
+    unsigned int n_accept = 0;
+    
+    for(unsigned int b = 0; b < blk.n_blk; ++b){
+      
+      // Propose the block and its prior ratio
+      unsigned int j0 = b * blk.size;
+      unsigned int d = std::min(p - j0, blk.size);
+      double log_prior = 0.0;
+      for(unsigned int j = j0; j < j0 + d; ++j){
+        double b_old = beta_mat(k, j);
+        double b_new = b_old + scale * mh.sd[j] * rng.norm();
+        blk.beta_new[j - j0] = b_new;
+        blk.xi_new[j - j0] = b_new;
+        log_prior += ((b_old - mu) * (b_old - mu) - 
+          (b_new - mu) * (b_new - mu)) / (2 * s2);
+      }
+      vexp(&blk.xi_new[0], d);
+      vlgamma(&blk.xi_new[0], &blk.lg_new[0], d);
+      double delta_sum = 0.0;
+      for(unsigned int jj = 0; jj < d; ++jj){
+        blk.delta[jj] = blk.xi_new[jj] - stat.xi[j0 + jj];
+        delta_sum += blk.delta[jj];
+      }
+      
+      // Likelihood ratio over the entries of the block; the lgamma go 
+      // through vlgamma, with their signs
+      double logA = log_prior;
+      blk.lg_plus.clear();
+      blk.lg_minus.clear();
+      for(unsigned int m = blk.member_ptr[k]; m < blk.member_ptr[k + 1]; ++m){
+        unsigned int i = blk.members[m];
+        std::size_t r = static_cast<std::size_t>(i) * (blk.n_blk + 1) + b;
+        
+        for(std::uint32_t e = blk.nz_start[r]; e < blk.nz_start[r + 1]; ++e){
+          unsigned int jj = data.nz_col[e] - j0;
+          blk.lg_plus.push_back(data.nz_count[e] + blk.xi_new[jj]);
+          logA -= blk.lg_new[jj];
+          if(stat.has_rise and (data.nz_rise[e] != no_rise)){
+            logA -= stat.rise[data.nz_rise[e]];
+          } else {
+            blk.lg_minus.push_back(data.nz_count[e] + stat.xi[j0 + jj]);
+            logA += stat.lg_xi[j0 + jj];
+          }
+        }
+        
+        double sum_old = blk.at_risk_sum[i];
+        double sum_new = sum_old + delta_sum;
+        for(std::uint32_t e = blk.zero_start[r]; e < blk.zero_start[r + 1]; ++e){
+          if(gamma[e] == 0){
+            sum_new -= blk.delta[data.zero_col[e] - j0];
+          }
+        }
+        blk.sum_new[i] = sum_new;
+        blk.lg_plus.push_back(sum_new);
+        blk.lg_plus.push_back(sum_old + data.total[i]);
+        blk.lg_minus.push_back(sum_new + data.total[i]);
+        blk.lg_minus.push_back(sum_old);
+      }
+      
+      if(not blk.lg_plus.empty()){
+        vlgamma(&blk.lg_plus[0], &blk.lg_plus[0], blk.lg_plus.size());
+      }
+      if(not blk.lg_minus.empty()){
+        vlgamma(&blk.lg_minus[0], &blk.lg_minus[0], blk.lg_minus.size());
+      }
+      for(std::size_t v = 0; v < blk.lg_plus.size(); ++v){
+        logA += blk.lg_plus[v];
+      }
+      for(std::size_t v = 0; v < blk.lg_minus.size(); ++v){
+        logA -= blk.lg_minus[v];
+      }
+      
+      // MH; the cached xi of the block are not used again in this update
+      if(std::log(rng.unif()) <= logA){
+        n_accept += 1;
+        for(unsigned int j = j0; j < j0 + d; ++j){
+          beta_mat(k, j) = blk.beta_new[j - j0];
+        }
+        for(unsigned int m = blk.member_ptr[k]; m < blk.member_ptr[k + 1]; ++m){
+          unsigned int i = blk.members[m];
+          blk.at_risk_sum[i] = blk.sum_new[i];
+        }
+      }
+      
+    }
+    
+    if(n_accept > 0){
+      cache[k].set(beta_mat.memptr() + k, p, beta_mat.n_rows);
+      cache[k].tabulate(data.rise_ptr);
+    }
+    mh.tried[k] += blk.n_blk;
+    mh.accepted[k] += n_accept;
+    if(adapt){
+      mh.step(k, (double)n_accept / blk.n_blk, beta_mat);
+    }
+  }
+  if(adapt){
+    mh.refresh_sd(blk.size);
+  }
+  
+}
+
+inline void realloc(const zidm_data &data, arma::uvec &clus_assign,
+                    const at_risk_vec &gamma, const clus_cache &cache,
+                    const arma::vec &theta_vec, const rng_key &key,
+                    std::uint64_t iter, sampler_work &work){
+  
+  /* Reallocate in place among the clusters active at the start. On return,
+     work.nk holds the new cluster sizes, which the caller uses to adjust tau
+     and beta for the emptied clusters. */
+  
+  work.count(clus_assign);
+  const unsigned int K_pos = work.n_active;
+  
+  // Reallocate
+  for(unsigned int i = 0; i < data.n; ++i){
+    
+    work.nk[clus_assign[i]] -= 1;
+    
+    log_marginal(data, i, gamma, cache, &work.active[0], K_pos, 
+                 work.log_prob.memptr(), &work.lgamma_buf[0]);
+    for(unsigned int kk = 0; kk < K_pos; ++kk){
+      unsigned int k = work.active[kk];
+      work.log_prob[kk] += std::log(theta_vec[k] + work.nk[k]);
+    }
+    
+    rng_stream rng(key, iter, step_realloc, i);
+    unsigned int new_ck = log_categorical(work.log_prob.memptr(), K_pos, rng);
+    
+    // New assign
+    clus_assign[i] = work.active[new_ck];
+    
+    work.nk[clus_assign[i]] += 1;
+    
+  }
+  
+}
+
+inline void realloc_blocked(const zidm_data &data, arma::uvec &clus_assign,
+                            const at_risk_vec &gamma, const clus_cache &cache,
+                            const arma::vec &tau_vec, const rng_key &key,
+                            std::uint64_t iter, unsigned int n_threads, 
+                            sampler_work &work){
+  
+  /* Blocked reallocation among the clusters active at the start. Given tau,
+     the mixture weights are tau / sum(tau) and the labels are conditionally
+     independent, with p(c_i = k) proportional to tau_k times the marginal of 
+     sample i in cluster k. All labels are therefore drawn in parallel, each
+     sample from its own stream. On return, work.nk holds the new cluster 
+     sizes, as in realloc(). */
+  
+  work.count(clus_assign);
+  const unsigned int K_pos = work.n_active;
+  const unsigned int K = work.nk.n_elem;
+  
+  for(unsigned int kk = 0; kk < K_pos; ++kk){
+    work.log_prob[kk] = std::log(tau_vec[work.active[kk]]);
+  }
+  
+  // 3 K doubles per thread: the weights and the lgamma buffer. The buffer 
+  // is sized for the team that actually runs, which OpenMP may choose
+  if(work.thread_buf.size() < 3 * K){
+    work.thread_buf.resize(3 * K);
+  }
+  
+  const int n = data.n;
+  
+  #pragma omp parallel num_threads(n_threads)
+  {
+    #ifdef _OPENMP
+    #pragma omp single
+    {
+      std::size_t size = 3 * K * (std::size_t)omp_get_num_threads();
+      if(work.thread_buf.size() < size){
+        work.thread_buf.resize(size);
+      }
+    }
+    double *prob = &work.thread_buf[3 * K * omp_get_thread_num()];
+    #else
+    double *prob = &work.thread_buf[0];
+    #endif
+    
+    #pragma omp for schedule(dynamic, 16)
+    for(int i = 0; i < n; ++i){
+      log_marginal(data, i, gamma, cache, &work.active[0], K_pos, prob, 
+                   prob + K);
+      for(unsigned int kk = 0; kk < K_pos; ++kk){
+        prob[kk] += work.log_prob[kk];
+      }
+      rng_stream rng(key, iter, step_realloc, i);
+      clus_assign[i] = work.active[log_categorical(prob, K_pos, rng)];
+    }
+  }
+  
+  work.count(clus_assign);
+  
+}
+
+struct sm_result {
+  
+  /* Outcome of one split-merge proposal; the set S is left in work.S */
+  
+  double logA;
+  int expand_ind;
+  int sm_accept;
+  
+};
+
+inline double log_dirichlet_mult(const arma::vec &nk,
+                                 const arma::vec &theta_vec){
+  
+  /* log of the Dirichlet-multinomial normalizing terms over the clusters
+     with nk > 0 */
+  
+  double sum_theta = 0.0;
+  double sum_n_theta = 0.0;
+  double result = 0.0;
+  for(unsigned int k = 0; k < nk.n_elem; ++k){
+    if(nk[k] > 0){
+      sum_theta += theta_vec[k];
+      sum_n_theta += nk[k] + theta_vec[k];
+      result += std::lgamma(nk[k] + theta_vec[k]) - std::lgamma(theta_vec[k]);
+    }
+  }
+  return result + std::lgamma(sum_theta) - std::lgamma(sum_n_theta);
+  
+}
+
+inline sm_result sm(unsigned int K_max, const zidm_data &data,
+                    arma::uvec &clus_assign, const at_risk_vec &gamma,
+                    arma::mat &beta_mat, clus_cache &cache, arma::vec &tau_vec,
+                    const arma::vec &theta_vec, unsigned int launch_iter,
+                    double mu, double s2, double /*r0c*/, double /*r1c*/,
+                    rng_stream &rng, unsigned int n_threads,
+                    sampler_work &work){
+  
+  /* Expand/Collapse the cluster space via Split-Merge. The assignment, beta
+     and tau are replaced by the proposal when it is accepted. The new
+     cluster of a split is inactive before the proposal, so its cache can be
+     refreshed in place whether or not the proposal is accepted. The 
+     marginals of S in the two clusters are computed once, on n_threads 
+     threads, and reused by the launch sweeps, the proposal densities and 
+     the MH ratio. Only the samples of S and the two sampled ones can move,
+     so the likelihood ratio is computed over these. */
+  
+  unsigned int n = data.n;
+  work.count(clus_assign);
+  unsigned int K_pos = work.n_active;
+  int expand_ind = -1;
+  
+  // Decide to expand (split) or collapse (merge)
+  unsigned int samp_ind[2];
+  do {
+    samp_ind[0] = rng.index(n);
+    samp_ind[1] = rng.index(n - 1);
+    if(samp_ind[1] >= samp_ind[0]){
+      samp_ind[1] += 1;
+    }
+  } while((K_pos == K_max) and
+            (clus_assign[samp_ind[0]] == clus_assign[samp_ind[1]]));
+  
+  // Create a set S
+  unsigned int samp_clus[2];
+  samp_clus[0] = clus_assign[samp_ind[0]];
+  samp_clus[1] = clus_assign[samp_ind[1]];
+  work.S.clear();
+  for(unsigned int i = 0; i < n; ++i){
+    if(((clus_assign[i] == samp_clus[0]) or (clus_assign[i] == samp_clus[1]))
+         and (i != samp_ind[0]) and (i != samp_ind[1])){
+      work.S.push_back(i);
+    }
+  }
+  const std::vector<unsigned int> &S = work.S;
+  
+  arma::uvec &launch_assign = work.launch_assign;
+  arma::vec &launch_tau = work.launch_tau;
+  arma::mat &launch_beta = work.launch_beta;
+  launch_assign = clus_assign;
+  launch_tau = tau_vec;
+  launch_beta = beta_mat;
+  
+  if(samp_clus[0] == samp_clus[1]){ // Split
+    expand_ind = 1;
+    unsigned int n_inactive = 0;
+    for(unsigned int k = 0; k < K_max; ++k){
+      n_inactive += (tau_vec[k] == 0);
+    }
+    unsigned int r = rng.index(n_inactive);
+    unsigned int new_ck = 0;
+    for(unsigned int k = 0; k < K_max; ++k){
+      if(tau_vec[k] == 0){
+        if(r == 0){
+          new_ck = k;
+          break;
+        }
+        r -= 1;
+      }
+    }
+    launch_assign[samp_ind[0]] = new_ck;
+    samp_clus[0] = new_ck;
+    launch_tau[new_ck] = rng.gamma(theta_vec[new_ck], 1.0);
+    for(unsigned int j = 0; j < data.p; ++j){
+      launch_beta(new_ck, j) = mu + std::sqrt(s2) * rng.norm();
+    }
+    cache[new_ck].set(launch_beta.memptr() + new_ck, launch_beta.n_cols,
+                      launch_beta.n_rows);
+    cache[new_ck].tabulate(data.rise_ptr);
+  } else { // Merge
+    expand_ind = 0;
+  }
+  
+  // Marginals of S in the two clusters
+  const std::vector<double> &marg = work.sm_marg;
+  sm_marginals(data, gamma, cache, S, samp_clus, n_threads, work.sm_marg);
+  
+  // Perform a launch step
+  for(unsigned int ss = 0; ss < S.size(); ++ss){
+    launch_assign[S[ss]] = samp_clus[rng.unif() >= 0.5];
+  }
+  for(unsigned int t = 0; t <= launch_iter; ++t){
+    realloc_sm(launch_assign, S, samp_clus, marg, rng);
+  }
+  
+  // Perform last SM
+  arma::uvec &proposed_assign = work.proposed_assign;
+  proposed_assign = launch_assign;
+  if(expand_ind == 1){
+    realloc_sm(proposed_assign, S, samp_clus, marg, rng);
+  } else {
+    for(unsigned int ss = 0; ss < S.size(); ++ss){
+      proposed_assign[S[ss]] = samp_clus[1];
+    }
+    proposed_assign[samp_ind[0]] = samp_clus[1];
+    proposed_assign[samp_ind[1]] = samp_clus[1];
+  }
+  
+  // MH; the other samples keep their cluster and cancel out. Both the 
+  // current and the proposed cluster of a sample of S are in samp_clus.
+  double logA = 0.0;
+  arma::vec &nk_proposed = work.nk_proposed;
+  nk_proposed = work.nk;
+  
+  for(unsigned int ss = 0; ss < S.size(); ++ss){
+    unsigned int i = S[ss];
+    logA += marg[2 * ss + (proposed_assign[i] != samp_clus[0])];
+    logA -= marg[2 * ss + (clus_assign[i] != samp_clus[0])];
+    nk_proposed[clus_assign[i]] -= 1;
+    nk_proposed[proposed_assign[i]] += 1;
+  }
+  for(int ii = 0; ii <= 1; ++ii){
+    unsigned int i = samp_ind[ii];
+    logA += log_marginal(data, i, gamma, cache[proposed_assign[i]]);
+    logA -= log_marginal(data, i, gamma, cache[clus_assign[i]]);
+    nk_proposed[clus_assign[i]] -= 1;
+    nk_proposed[proposed_assign[i]] += 1;
+  }
+  
+  arma::mat &proposed_beta = work.proposed_beta;
+  arma::vec &proposed_tau = work.proposed_tau;
+  proposed_beta = launch_beta;
+  proposed_tau = launch_tau;
+  adjust_tau_beta(nk_proposed, proposed_tau, proposed_beta);
+  
+  logA += log_dirichlet_mult(nk_proposed, theta_vec);
+  logA -= log_dirichlet_mult(work.nk, theta_vec);
+  
+  // The normal prior of every element of beta (the constants cancel)
+  for(unsigned int e = 0; e < beta_mat.n_elem; ++e){
+    double b = beta_mat[e];
+    double b_new = proposed_beta[e];
+    logA += ((b - mu) * (b - mu) - (b_new - mu) * (b_new - mu)) / (2 * s2);
+  }
+  
+  logA += log_proposal(launch_assign, proposed_assign, S, samp_clus, marg);
+  if(expand_ind == 1){
+    logA -= log_proposal(proposed_assign, launch_assign, S, samp_clus, marg);
+  }
+  
+  // MH
+  double logU = std::log(rng.unif());
+  sm_result result;
+  result.logA = logA;
+  result.expand_ind = expand_ind;
+  result.sm_accept = 0;
+  if(logU <= logA){
+    result.sm_accept += 1;
+    clus_assign.swap(proposed_assign);
+    beta_mat.swap(proposed_beta);
+    tau_vec.swap(proposed_tau);
+  }
+  return result;
+  
+}
+
+inline void update_tau(const arma::uvec &clus_assign, arma::vec &tau_vec,
+                       const arma::vec &theta_vec, double &U,
+                       const rng_key &key, std::uint64_t iter,
+                       sampler_work &work){
+  
+  /* Update tau and U in place */
+  
+  rng_stream rng(key, iter, step_tau);
+  
+  work.count(clus_assign);
+  double scale_U = 1/(1 + U);
+  
+  for(unsigned int kk = 0; kk < work.n_active; ++kk){
+    unsigned int k = work.active[kk];
+    tau_vec[k] = rng.gamma(work.nk[k] + theta_vec[k], scale_U);
+  }
+  
+  double scale_u = 1/arma::accu(tau_vec);
+  U = rng.gamma(clus_assign.size(), scale_u);
+  
+}
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef CLUSTERZI_ZIDM_SIMD_H
+#define CLUSTERZI_ZIDM_SIMD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/* Batch exp, log and lgamma over contiguous buffers.
+ *
+ * The element functions have no calls and no data-dependent branches, so
+ * the batch loops are vectorized (omp simd, the package is compiled with
+ * the OpenMP flags). On x86-64 Linux with GCC, every batch function
+ * is compiled for AVX-512, AVX2 and the baseline instruction set, and the
+ * version matching the CPU is chosen when the package is loaded
+ * (target_clones); elsewhere only the baseline version is built, which is
+ * the scalar fallback. Define CLUSTERZI_NO_SIMD to disable the clones.
+ *
+ * Accuracy, against the C library on the domains used by the samplers:
+ *   vexp     x in [-708, 709]: relative error below 4e-16. Smaller x give
+ *            about 2^-1021 instead of 0.
+ *   vlog     positive normal x: relative error below 4e-16.
+ *   vlgamma  x in (0, 1e15): absolute error below 1e-14 for x < 8,
+ *            relative error below 2e-15 above (Lanczos, g = 7, n = 9).
+ * The marginals therefore agree with the std::lgamma ones to a relative
+ * error of about 1e-15, and a chain only departs from the scalar one when a
+ * uniform draw falls that close to an acceptance threshold.
+ */
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && \
+    defined(__linux__) && !defined(CLUSTERZI_NO_SIMD)
+#define CLUSTERZI_CLONES \
+  __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define CLUSTERZI_CLONES
+#endif
+
+namespace simd {
+
+inline double from_bits(std::uint64_t b){
+  double x;
+  std::memcpy(&x, &b, sizeof(x));
+  return x;
+}
+
+inline std::uint64_t to_bits(double x){
+  std::uint64_t b;
+  std::memcpy(&b, &x, sizeof(b));
+  return b;
+}
+
+inline double exp1(double x){
+
+  /* exp(x) = 2^k exp(r), |r| <= log(2)/2. Adding 1.5 * 2^52 rounds
+     x / log(2) to the nearest integer k, which is left in the low bits. */
+
+  const double shifter = 6755399441055744.0;
+  x = x < -708.0 ? -708.0 : x;
+  x = x > 709.0 ? 709.0 : x;
+  double t = x * 1.4426950408889634 + shifter;
+  double k = t - shifter;
+  double r = x - k * 6.93147180369123816490e-01;
+  r = r - k * 1.90821492927058770002e-10;
+
+  // Taylor polynomial of degree 13
+  double p = 1.0 / 6227020800.0;
+  p = p * r + 1.0 / 479001600.0;
+  p = p * r + 1.0 / 39916800.0;
+  p = p * r + 1.0 / 3628800.0;
+  p = p * r + 1.0 / 362880.0;
+  p = p * r + 1.0 / 40320.0;
+  p = p * r + 1.0 / 5040.0;
+  p = p * r + 1.0 / 720.0;
+  p = p * r + 1.0 / 120.0;
+  p = p * r + 1.0 / 24.0;
+  p = p * r + 1.0 / 6.0;
+  p = p * r + 0.5;
+  p = p * r + 1.0;
+  p = p * r + 1.0;
+
+  return p * from_bits((to_bits(t) + 1023) << 52);
+
+}
+
+inline double log1(double x){
+
+  /* log(x) = e log(2) + log(m), m in [sqrt(1/2), sqrt(2)), with
+     log(m) = 2 atanh(s), s = (m - 1) / (m + 1), |s| < 0.172. */
+
+  std::uint64_t b = to_bits(x);
+  double m = from_bits((b & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+  double e = from_bits((b >> 52) | 0x4330000000000000ULL) - 4503599627371519.0;
+  double big = m > 1.4142135623730951 ? 1.0 : 0.0;
+  m = m * (1.0 - 0.5 * big);
+  e = e + big;
+
+  double s = (m - 1.0) / (m + 1.0);
+  double s2 = s * s;
+  double p = 1.0 / 23;
+  p = p * s2 + 1.0 / 21;
+  p = p * s2 + 1.0 / 19;
+  p = p * s2 + 1.0 / 17;
+  p = p * s2 + 1.0 / 15;
+  p = p * s2 + 1.0 / 13;
+  p = p * s2 + 1.0 / 11;
+  p = p * s2 + 1.0 / 9;
+  p = p * s2 + 1.0 / 7;
+  p = p * s2 + 1.0 / 5;
+  p = p * s2 + 1.0 / 3;
+  double log_m = 2.0 * s + 2.0 * s * s2 * p;
+
+  return e * 6.93147180369123816490e-01 + (log_m + e * 1.90821492927058770002e-10);
+
+}
+
+inline double lgamma1(double x){
+
+  /* Lanczos approximation for x >= 1/2, and lgamma(x + 1) - log(x) below */
+
+  double shift = x < 0.5 ? 1.0 : 0.0;
+  double z = x + shift - 1.0;
+  double a = 0.99999999999980993;
+  a += 676.5203681218851 / (z + 1.0);
+  a -= 1259.1392167224028 / (z + 2.0);
+  a += 771.32342877765313 / (z + 3.0);
+  a -= 176.61502916214059 / (z + 4.0);
+  a += 12.507343278686905 / (z + 5.0);
+  a -= 0.13857109526572012 / (z + 6.0);
+  a += 9.9843695780195716e-6 / (z + 7.0);
+  a += 1.5056327351493116e-7 / (z + 8.0);
+  double t = z + 7.5;
+
+  double result = 0.91893853320467274 + (z + 0.5) * log1(t) - t + log1(a);
+  return result - shift * log1(x);
+
+}
+
+}
+
+// x[v] = exp(x[v])
+CLUSTERZI_CLONES
+inline void vexp(double *x, std::size_t size){
+  #pragma omp simd
+  for(std::size_t v = 0; v < size; ++v){
+    x[v] = simd::exp1(x[v]);
+  }
+}
+
+// x[v] = log(x[v])
+CLUSTERZI_CLONES
+inline void vlog(double *x, std::size_t size){
+  #pragma omp simd
+  for(std::size_t v = 0; v < size; ++v){
+    x[v] = simd::log1(x[v]);
+  }
+}
+
+// out[v] = lgamma(x[v]) for x[v] > 0; out may be x
+CLUSTERZI_CLONES
+inline void vlgamma(const double *x, double *out, std::size_t size){
+  #pragma omp simd
+  for(std::size_t v = 0; v < size; ++v){
+    out[v] = simd::lgamma1(x[v]);
+  }
+}
+
+#endif
@@ -0,0 +1,413 @@
+#ifndef CLUSTERZI_ZIDM_TABLE_H
+#define CLUSTERZI_ZIDM_TABLE_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <armadillo>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Count tables on disk, for programs that run the samplers without R.
+ *
+ * Delimited text (CSV, TSV): one line per sample and one column per taxon,
+ * or the transpose with taxa_rows (as an OTU table). The first line may
+ * name the taxa, and the first column may name the samples; quoted names,
+ * as written by write.csv, are unquoted. The file is read one line at a
+ * time. Every count must be a non-negative integer.
+ *
+ * Binary (host byte order):
+ *
+ *   header   magic "CZICOUNT", then uint32 version and value type (0:
+ *            double, 1: uint32), uint64 n and p
+ *   values   the n x p counts, column-major (a taxon after the other)
+ *
+ * The binary file is memory-mapped, and only the taxa that pass the
+ * prevalence filter are copied.
+ *
+ * With min_prevalence > 0, the taxa that are non-zero in less than that
+ * fraction of the samples are dropped, as z[, colMeans(z > 0) >= 0.1] in R.
+ */
+
+static const char count_magic[8] = {'C', 'Z', 'I', 'C', 'O', 'U', 'N', 'T'};
+static const std::uint32_t count_version = 1;
+
+enum count_type {
+  count_double = 0,
+  count_uint32 = 1
+};
+
+struct count_file_header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t type;
+  std::uint64_t n;
+  std::uint64_t p;
+};
+
+struct table_format {
+
+  std::string format;       // "csv", "tsv" or "bin"; "" from the extension
+  bool header;              // first line names the taxa
+  bool row_names;           // first column names the samples
+  bool taxa_rows;           // one line per taxon
+  double min_prevalence;
+
+  table_format(): header(true), row_names(true), taxa_rows(false),
+    min_prevalence(0.0) {}
+
+};
+
+struct count_table {
+
+  arma::mat z;                       // samples x kept taxa
+  std::vector<std::string> samples;  // empty without names
+  std::vector<std::string> taxa;     // names of the kept taxa, or empty
+  std::vector<unsigned int> keep;    // columns of the kept taxa in the file
+  unsigned int p_file;               // taxa in the file
+
+};
+
+inline std::string table_format_of(const std::string &path,
+                                   const std::string &format){
+
+  /* format, or the one of the extension of path */
+
+  if(not format.empty()){
+    if(format != "csv" and format != "tsv" and format != "bin"){
+      throw std::invalid_argument("unknown table format \"" + format + "\".");
+    }
+    return format;
+  }
+  std::string::size_type dot = path.find_last_of('.');
+  std::string ext = (dot == std::string::npos) ? "" : path.substr(dot + 1);
+  if(ext == "csv" or ext == "tsv" or ext == "bin"){
+    return ext;
+  } else if(ext == "txt"){
+    return "tsv";
+  }
+  throw std::invalid_argument("cannot tell the format of " + path +
+                              " from its extension.");
+
+}
+
+inline std::vector<unsigned int> prevalent_taxa(const arma::mat &z,
+                                                double min_prevalence){
+
+  /* Columns of z that are non-zero in at least min_prevalence of the rows */
+
+  std::vector<unsigned int> keep;
+  for(unsigned int j = 0; j < z.n_cols; ++j){
+    double n_pos = 0.0;
+    const double *col = z.colptr(j);
+    for(unsigned int i = 0; i < z.n_rows; ++i){
+      n_pos += (col[i] > 0);
+    }
+    if(n_pos >= min_prevalence * z.n_rows){
+      keep.push_back(j);
+    }
+  }
+  return keep;
+
+}
+
+inline void split_fields(const std::string &line, char delim,
+                         std::vector<std::string> &fields){
+
+  /* Fields of line; a field in double quotes may hold delim, and "" in it
+   * is a quote */
+
+  fields.clear();
+  std::string field;
+  bool quoted = false;
+  for(std::string::size_type c = 0; c < line.size(); ++c){
+    char ch = line[c];
+    if(quoted){
+      if(ch == '"' and c + 1 < line.size() and line[c + 1] == '"'){
+        field += '"';
+        c += 1;
+      } else if(ch == '"'){
+        quoted = false;
+      } else {
+        field += ch;
+      }
+    } else if(ch == '"'){
+      quoted = true;
+    } else if(ch == delim){
+      fields.push_back(field);
+      field.clear();
+    } else if(ch != '\r'){
+      field += ch;
+    }
+  }
+  fields.push_back(field);
+
+}
+
+inline double parse_count(const std::string &field, const std::string &path,
+                          std::size_t line){
+
+  /* A non-negative integer count */
+
+  const char *begin = field.c_str();
+  char *end = NULL;
+  double value = std::strtod(begin, &end);
+  while(*end == ' '){
+    ++end;
+  }
+  if(end == begin or *end != '\0' or not (value >= 0) or
+       value != std::floor(value) or value > 4294967295.0){
+    std::ostringstream msg;
+    msg << path << ", line " << line << ": \"" << field
+        << "\" is not a count.";
+    throw std::runtime_error(msg.str());
+  }
+  return value;
+
+}
+
+inline count_table read_delim(const std::string &path, char delim,
+                              const table_format &fmt){
+
+  count_table table;
+  std::ifstream in(path.c_str());
+  if(not in){
+    throw std::runtime_error("cannot open " + path);
+  }
+
+  // Values of the lines, one line after the other
+  std::vector<std::string> fields, col_names, row_names;
+  std::vector<double> values;
+  std::size_t n_col = 0, n_line = 0, line_no = 0;
+  bool named = false;
+  std::string line;
+  while(std::getline(in, line)){
+    line_no += 1;
+    if(line.empty() or line == "\r"){
+      continue;
+    }
+    split_fields(line, delim, fields);
+    if(fmt.header and not named){
+      col_names = fields;
+      named = true;
+      continue;
+    }
+    std::size_t first = fmt.row_names ? 1 : 0;
+    if(fields.size() <= first){
+      std::ostringstream msg;
+      msg << path << ", line " << line_no << ": no count.";
+      throw std::runtime_error(msg.str());
+    }
+    if(n_line == 0){
+      n_col = fields.size() - first;
+    } else if(fields.size() - first != n_col){
+      std::ostringstream msg;
+      msg << path << ", line " << line_no << ": " << fields.size() - first
+          << " counts instead of " << n_col << ".";
+      throw std::runtime_error(msg.str());
+    }
+    if(fmt.row_names){
+      row_names.push_back(fields[0]);
+    }
+    for(std::size_t c = first; c < fields.size(); ++c){
+      values.push_back(parse_count(fields[c], path, line_no));
+    }
+    n_line += 1;
+  }
+  if(n_line == 0){
+    throw std::runtime_error(path + " has no count.");
+  }
+
+  // The header may or may not name the column of the row names
+  if(fmt.header and fmt.row_names and col_names.size() == n_col + 1){
+    col_names.erase(col_names.begin());
+  }
+  if(fmt.header and col_names.size() != n_col){
+    throw std::runtime_error(path + ": the header does not match the counts.");
+  }
+
+  // values is line-major, so it is the column-major transpose of the lines
+  arma::mat by_line(values.data(), n_col, n_line);
+  if(fmt.taxa_rows){
+    table.z = by_line;
+    table.samples = col_names;
+    table.taxa = row_names;
+  } else {
+    table.z = by_line.t();
+    table.samples = row_names;
+    table.taxa = col_names;
+  }
+
+  table.p_file = table.z.n_cols;
+  table.keep = prevalent_taxa(table.z, fmt.min_prevalence);
+  if(table.keep.size() < table.z.n_cols){
+    arma::uvec cols(table.keep.size());
+    std::vector<std::string> taxa;
+    for(std::size_t j = 0; j < table.keep.size(); ++j){
+      cols[j] = table.keep[j];
+      if(not table.taxa.empty()){
+        taxa.push_back(table.taxa[table.keep[j]]);
+      }
+    }
+    table.z = arma::mat(table.z.cols(cols));
+    table.taxa.swap(taxa);
+  }
+  return table;
+
+}
+
+inline count_table read_count_bin(const std::string &path,
+                                  const table_format &fmt){
+
+  count_table table;
+  std::vector<unsigned char> copy;
+  const unsigned char *data = NULL;
+  std::size_t size = 0;
+
+#if defined(_WIN32)
+  std::FILE *f = std::fopen(path.c_str(), "rb");
+  if(f == NULL){
+    throw std::runtime_error("cannot open " + path);
+  }
+  std::fseek(f, 0, SEEK_END);
+  size = std::ftell(f);
+  std::fseek(f, 0, SEEK_SET);
+  copy.resize(size);
+  if(size > 0 and std::fread(&copy[0], 1, size, f) != size){
+    std::fclose(f);
+    throw std::runtime_error("cannot read " + path);
+  }
+  std::fclose(f);
+  data = size > 0 ? &copy[0] : NULL;
+#else
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0){
+    throw std::runtime_error("cannot open " + path);
+  }
+  struct stat st;
+  if(::fstat(fd, &st) != 0){
+    ::close(fd);
+    throw std::runtime_error("cannot stat " + path);
+  }
+  size = st.st_size;
+  void *map = NULL;
+  if(size > 0){
+    map = ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED){
+      ::close(fd);
+      throw std::runtime_error("cannot map " + path);
+    }
+    data = static_cast<const unsigned char *>(map);
+  }
+  ::close(fd);
+#endif
+
+  count_file_header header;
+  bool valid = size >= sizeof(header);
+  if(valid){
+    std::memcpy(&header, data, sizeof(header));
+    std::size_t width = (header.type == count_uint32) ? 4 : 8;
+    valid = std::memcmp(header.magic, count_magic, 8) == 0 and
+      header.version == count_version and header.type <= count_uint32 and
+      header.n > 0 and header.p > 0 and
+      (size - sizeof(header)) / width / header.n >= header.p;
+  }
+  if(valid){
+    const unsigned char *values = data + sizeof(header);
+    const std::size_t n = header.n;
+    table.p_file = header.p;
+
+    // Prevalence of every taxon, then a copy of the kept ones
+    std::vector<double> col(n);
+    std::vector<double> kept;
+    for(std::size_t j = 0; j < header.p; ++j){
+      double n_pos = 0.0;
+      if(header.type == count_uint32){
+        for(std::size_t i = 0; i < n; ++i){
+          std::uint32_t x;
+          std::memcpy(&x, values + 4 * (j * n + i), 4);
+          col[i] = x;
+        }
+      } else {
+        std::memcpy(&col[0], values + 8 * j * n, 8 * n);
+      }
+      for(std::size_t i = 0; i < n; ++i){
+        n_pos += (col[i] > 0);
+      }
+      if(n_pos >= fmt.min_prevalence * n){
+        table.keep.push_back(j);
+        kept.insert(kept.end(), col.begin(), col.end());
+      }
+    }
+    table.z = arma::mat(kept.data(), n, table.keep.size());
+  }
+
+#if !defined(_WIN32)
+  if(map != NULL){
+    ::munmap(map, size);
+  }
+#endif
+  if(not valid){
+    throw std::runtime_error(path + " is not a count file.");
+  }
+  for(std::size_t e = 0; e < table.z.n_elem; ++e){
+    double x = table.z[e];
+    if(not (x >= 0) or x != std::floor(x) or x > 4294967295.0){
+      throw std::runtime_error(path + " has a value that is not a count.");
+    }
+  }
+  return table;
+
+}
+
+inline count_table read_counts(const std::string &path,
+                               const table_format &fmt){
+
+  /* The count table of path, with the taxa that pass the prevalence
+   * filter */
+
+  std::string format = table_format_of(path, fmt.format);
+  if(format == "bin"){
+    return read_count_bin(path, fmt);
+  }
+  return read_delim(path, (format == "csv") ? ',' : '\t', fmt);
+
+}
+
+inline void write_count_bin(const std::string &path, const arma::mat &z){
+
+  /* z in the binary format, as doubles */
+
+  count_file_header header;
+  std::memcpy(header.magic, count_magic, 8);
+  header.version = count_version;
+  header.type = count_double;
+  header.n = z.n_rows;
+  header.p = z.n_cols;
+  std::FILE *f = std::fopen(path.c_str(), "wb");
+  if(f == NULL){
+    throw std::runtime_error("cannot open " + path);
+  }
+  bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1 and
+    std::fwrite(z.memptr(), sizeof(double), z.n_elem, f) == z.n_elem;
+  ok = (std::fclose(f) == 0) and ok;
+  if(not ok){
+    throw std::runtime_error("cannot write " + path);
+  }
+
+}
+
+#endif
@@ -0,0 +1,674 @@
+#ifndef CLUSTERZI_ZIDM_TRACE_H
+#define CLUSTERZI_ZIDM_TRACE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Streaming on-disk storage of MCMC traces.
+ *
+ * File layout (host byte order):
+ *
+ *   file header   magic "CZITRACE", then uint32 version, n, p, K_max, mask
+ *                 (which traces are stored) and two reserved fields
+ *   chunk*        uint32 trace id, number of records, encoding, reserved,
+ *                 uint64 raw size and stored size (bytes), then the payload
+ *
+ * Every chunk holds consecutive iterations of one trace, so the file is only
+ * ever appended to and a run that stops early still leaves readable chunks.
+ * Labels are stored as uint16, at-risk indicators as bits and the remaining
+ * traces as doubles, all column-major like the arma objects they come from.
+ * With compression, each record is XOR-ed with the previous record of its
+ * chunk (unchanged labels, indicators and rejected beta proposals become
+ * zero bytes) and the result is run-length encoded.
+ *
+ * A chain resumed from a checkpoint continues its trace file: the checkpoint
+ * keeps the position of the file (trace_position) when it was saved, and
+ * the writer cuts the file back to it, dropping the records written after
+ * the checkpoint, and appends the new chunks.
+ */
+
+enum trace_id {
+  trace_assign = 0,
+  trace_gamma = 1,
+  trace_beta = 2,
+  trace_tau = 3,
+  trace_U = 4,
+  trace_logA = 5,
+  trace_sm = 6,
+  trace_accept = 7,
+  n_trace = 8
+};
+
+inline const char *trace_name(int id){
+  static const char *names[n_trace] = {"assign", "gamma", "beta", "tau", "U",
+                                       "logA", "sm", "accept"};
+  return names[id];
+}
+
+inline int trace_from_name(const std::string &name){
+  for(int id = 0; id < n_trace; ++id){
+    if(name == trace_name(id)){
+      return id;
+    }
+  }
+  return -1;
+}
+
+struct trace_dims {
+
+  std::uint32_t n;
+  std::uint32_t p;
+  std::uint32_t K;
+
+  // Number of values in one record of a trace
+  std::size_t values(int id) const {
+    switch(id){
+    case trace_assign: return n;
+    case trace_gamma: return static_cast<std::size_t>(n) * p;
+    case trace_beta: return static_cast<std::size_t>(K) * p;
+    case trace_tau: return K;
+    default: return 1;
+    }
+  }
+
+  // Number of bytes in one record of a trace
+  std::size_t bytes(int id) const {
+    switch(id){
+    case trace_assign: return 2 * values(id);
+    case trace_gamma: return (values(id) + 7) / 8;
+    default: return 8 * values(id);
+    }
+  }
+
+};
+
+struct trace_select {
+
+  /* Which iterations and which traces are recorded: iteration t (counted
+   * from the first iteration of the chain) is kept when t >= burn_in and
+   * (t - burn_in) is a multiple of thin. */
+
+  std::uint32_t burn_in;
+  std::uint32_t thin;
+  std::uint32_t mask;
+
+  trace_select(std::uint32_t burn_in_ = 0, std::uint32_t thin_ = 1,
+               std::uint32_t mask_ = 1u << trace_assign):
+    burn_in(burn_in_), thin(thin_), mask(mask_) {}
+
+  bool keep(std::uint32_t t) const {
+    return t >= burn_in and (t - burn_in) % thin == 0;
+  }
+
+  // Number of kept iterations out of iter
+  std::uint32_t n_keep(std::uint32_t iter) const {
+    return iter > burn_in ? (iter - burn_in + thin - 1) / thin : 0;
+  }
+
+  // Number of kept iterations among first, ..., first + iter - 1
+  std::uint32_t n_keep(std::uint32_t first, std::uint32_t iter) const {
+    return n_keep(first + iter) - n_keep(first);
+  }
+
+  bool has(int id) const {
+    return (mask >> id) & 1u;
+  }
+
+};
+
+static const char trace_magic[8] = {'C', 'Z', 'I', 'T', 'R', 'A', 'C', 'E'};
+static const std::uint32_t trace_version = 1;
+
+struct trace_file_header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t n;
+  std::uint32_t p;
+  std::uint32_t K;
+  std::uint32_t mask;
+  std::uint32_t reserved[2];
+};
+
+struct trace_position {
+
+  /* Length of a trace file and records of every stored trace in it, after
+   * trace_writer::sync() */
+
+  std::uint64_t bytes;     // 0 when there is no trace file
+  std::uint64_t records;
+
+  trace_position(): bytes(0), records(0) {}
+
+};
+
+struct trace_chunk_header {
+  std::uint32_t id;
+  std::uint32_t n_rec;
+  std::uint32_t encoding;   // 0: raw, 1: XOR-delta + run-length
+  std::uint32_t reserved;
+  std::uint64_t raw_bytes;
+  std::uint64_t stored_bytes;
+};
+
+inline void rle_encode(const unsigned char *x, std::size_t size,
+                       std::vector<unsigned char> &out){
+
+  /* Control byte c < 128: c + 1 literal bytes follow. Otherwise a run of
+     c - 126 (2 to 129) zero bytes. */
+
+  out.clear();
+  std::size_t i = 0;
+  while(i < size){
+    std::size_t run = 0;
+    while(i + run < size and x[i + run] == 0 and run < 129){
+      ++run;
+    }
+    if(run >= 2){
+      out.push_back(static_cast<unsigned char>(run + 126));
+      i += run;
+      continue;
+    }
+    std::size_t start = i;
+    std::size_t len = 0;
+    while(i < size and len < 128 and
+            not (i + 1 < size and x[i] == 0 and x[i + 1] == 0)){
+      ++i;
+      ++len;
+    }
+    out.push_back(static_cast<unsigned char>(len - 1));
+    out.insert(out.end(), x + start, x + start + len);
+  }
+
+}
+
+inline bool rle_decode(const unsigned char *x, std::size_t size,
+                       unsigned char *out, std::size_t out_size){
+
+  std::size_t i = 0;
+  std::size_t o = 0;
+  while(i < size){
+    unsigned int c = x[i++];
+    if(c < 128){
+      std::size_t len = c + 1;
+      if(i + len > size or o + len > out_size){
+        return false;
+      }
+      std::memcpy(out + o, x + i, len);
+      i += len;
+      o += len;
+    } else {
+      std::size_t len = c - 126;
+      if(o + len > out_size){
+        return false;
+      }
+      std::memset(out + o, 0, len);
+      o += len;
+    }
+  }
+  return o == out_size;
+
+}
+
+class trace_writer {
+
+public:
+
+  // New file at path, replacing any file there
+  trace_writer(const std::string &path, const trace_dims &dims_,
+               std::uint32_t mask_, bool compress_,
+               std::size_t chunk_bytes = 1 << 22):
+    dims(dims_), mask(mask_), compress(compress_), buffer(n_trace),
+    n_buffered(n_trace, 0), n_written(n_trace, 0), n_bytes(0),
+    chunk_rec(n_trace, 1), record(n_trace) {
+    setup(chunk_bytes);
+    create(path);
+  }
+
+  // Continue the file at path from pos, the position saved with the
+  // checkpoint of a chain (see the definition below)
+  trace_writer(const std::string &path, const trace_dims &dims_,
+               std::uint32_t mask_, bool compress_, const trace_position &pos,
+               std::size_t chunk_bytes = 1 << 22);
+
+  ~trace_writer(){
+    try {
+      close();
+    } catch(...) {
+    }
+  }
+
+  bool has(int id) const {
+    return (mask >> id) & 1u;
+  }
+
+  template <typename T>
+  void put_labels(const T *labels){
+    unsigned char *rec = &record[trace_assign][0];
+    for(std::size_t i = 0; i < dims.n; ++i){
+      std::uint16_t x = static_cast<std::uint16_t>(labels[i]);
+      std::memcpy(rec + 2 * i, &x, 2);
+    }
+    append(trace_assign);
+  }
+
+  template <typename T>
+  void put_bits(int id, const T *x){
+    std::vector<unsigned char> &rec = record[id];
+    std::fill(rec.begin(), rec.end(), 0);
+    std::size_t size = dims.values(id);
+    for(std::size_t v = 0; v < size; ++v){
+      if(x[v] != 0){
+        rec[v / 8] |= static_cast<unsigned char>(1u << (v % 8));
+      }
+    }
+    append(id);
+  }
+
+  void put_doubles(int id, const double *x){
+    std::memcpy(&record[id][0], x, dims.bytes(id));
+    append(id);
+  }
+
+  void put_scalar(int id, double x){
+    put_doubles(id, &x);
+  }
+
+  // Write the buffered records, so that the file is complete up to here
+  void sync(){
+    if(file == NULL){
+      return;
+    }
+    for(int id = 0; id < n_trace; ++id){
+      flush(id);
+    }
+    std::fflush(file);
+  }
+
+  void close(){
+    if(file == NULL){
+      return;
+    }
+    sync();
+    std::fclose(file);
+    file = NULL;
+  }
+
+  // Position of the file after sync(), for a checkpoint
+  trace_position position(){
+    sync();
+    trace_position pos;
+    if(file != NULL){
+      pos.bytes = n_bytes;
+      for(int id = n_trace - 1; id >= 0; --id){
+        if(has(id)){
+          pos.records = n_written[id];
+        }
+      }
+    }
+    return pos;
+  }
+
+private:
+
+  std::FILE *file;
+  trace_dims dims;
+  std::uint32_t mask;
+  bool compress;
+  std::vector<std::vector<unsigned char> > buffer;
+  std::vector<std::size_t> n_buffered;
+  std::vector<std::uint64_t> n_written;   // records on disk
+  std::uint64_t n_bytes;                  // length of the file
+  std::vector<std::size_t> chunk_rec;
+  std::vector<std::vector<unsigned char> > record;
+  std::vector<unsigned char> encoded;
+
+  void setup(std::size_t chunk_bytes){
+    file = NULL;
+    if(has(trace_assign) and dims.K > 65536){
+      throw std::runtime_error("trace_writer: K_max is too large to store "
+                               "the labels as uint16.");
+    }
+    for(int id = 0; id < n_trace; ++id){
+      std::size_t rec = dims.bytes(id);
+      record[id].assign(rec, 0);
+      if(rec > 0 and rec < chunk_bytes){
+        chunk_rec[id] = chunk_bytes / rec;
+      }
+    }
+  }
+
+  void create(const std::string &path){
+    file = std::fopen(path.c_str(), "wb");
+    if(file == NULL){
+      throw std::runtime_error("trace_writer: cannot open " + path);
+    }
+
+    trace_file_header header;
+    std::memcpy(header.magic, trace_magic, 8);
+    header.version = trace_version;
+    header.n = dims.n;
+    header.p = dims.p;
+    header.K = dims.K;
+    header.mask = mask;
+    header.reserved[0] = 0;
+    header.reserved[1] = 0;
+    write(&header, sizeof(header));
+  }
+
+  void write(const void *x, std::size_t size){
+    if(std::fwrite(x, 1, size, file) != size){
+      throw std::runtime_error("trace_writer: write failed.");
+    }
+    n_bytes += size;
+  }
+
+  void append(int id){
+    buffer[id].insert(buffer[id].end(), record[id].begin(), record[id].end());
+    n_buffered[id] += 1;
+    if(n_buffered[id] == chunk_rec[id]){
+      flush(id);
+    }
+  }
+
+  void flush(int id){
+
+    if(n_buffered[id] == 0){
+      return;
+    }
+
+    std::vector<unsigned char> &raw = buffer[id];
+    trace_chunk_header chunk;
+    chunk.id = id;
+    chunk.n_rec = n_buffered[id];
+    chunk.encoding = 0;
+    chunk.reserved = 0;
+    chunk.raw_bytes = raw.size();
+    chunk.stored_bytes = raw.size();
+
+    const unsigned char *payload = &raw[0];
+    if(compress){
+      std::size_t rec = dims.bytes(id);
+      for(std::size_t b = raw.size(); b-- > rec; ){
+        raw[b] ^= raw[b - rec];
+      }
+      rle_encode(&raw[0], raw.size(), encoded);
+      if(encoded.size() < raw.size()){
+        chunk.encoding = 1;
+        chunk.stored_bytes = encoded.size();
+        payload = &encoded[0];
+      } else {
+        // Not worth it: undo the delta and store the raw bytes
+        for(std::size_t b = rec; b < raw.size(); ++b){
+          raw[b] ^= raw[b - rec];
+        }
+      }
+    }
+
+    write(&chunk, sizeof(chunk));
+    write(payload, chunk.stored_bytes);
+    n_written[id] += n_buffered[id];
+
+    raw.clear();
+    n_buffered[id] = 0;
+
+  }
+
+};
+
+class trace_reader {
+
+public:
+
+  // Only the chunks in the first limit bytes of the file are read
+  explicit trace_reader(const std::string &path,
+                        std::uint64_t limit = UINT64_MAX):
+    data(NULL), size(0), end(0) {
+
+#if defined(_WIN32)
+    std::FILE *f = std::fopen(path.c_str(), "rb");
+    if(f == NULL){
+      throw std::runtime_error("trace_reader: cannot open " + path);
+    }
+    std::fseek(f, 0, SEEK_END);
+    size = std::ftell(f);
+    std::fseek(f, 0, SEEK_SET);
+    copy.resize(size);
+    if(size > 0 and std::fread(&copy[0], 1, size, f) != size){
+      std::fclose(f);
+      throw std::runtime_error("trace_reader: cannot read " + path);
+    }
+    std::fclose(f);
+    data = size > 0 ? &copy[0] : NULL;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+      throw std::runtime_error("trace_reader: cannot open " + path);
+    }
+    struct stat st;
+    if(::fstat(fd, &st) != 0){
+      ::close(fd);
+      throw std::runtime_error("trace_reader: cannot stat " + path);
+    }
+    size = st.st_size;
+    if(size > 0){
+      void *map = ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(map == MAP_FAILED){
+        ::close(fd);
+        throw std::runtime_error("trace_reader: cannot map " + path);
+      }
+      data = static_cast<const unsigned char *>(map);
+    }
+    ::close(fd);
+#endif
+
+    if(size < sizeof(trace_file_header)){
+      release();
+      throw std::runtime_error("trace_reader: " + path +
+                               " is not a trace file.");
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if(std::memcmp(header.magic, trace_magic, 8) != 0 or
+         header.version != trace_version){
+      release();
+      throw std::runtime_error("trace_reader: " + path +
+                               " is not a trace file.");
+    }
+    dims.n = header.n;
+    dims.p = header.p;
+    dims.K = header.K;
+
+    // Index the complete chunks; a truncated last chunk is ignored
+    n_rec.assign(n_trace, 0);
+    const std::uint64_t last = std::min<std::uint64_t>(size, limit);
+    std::size_t pos = sizeof(header);
+    while(pos + sizeof(trace_chunk_header) <= last){
+      trace_chunk_header chunk;
+      std::memcpy(&chunk, data + pos, sizeof(chunk));
+      if(chunk.id >= n_trace or
+           pos + sizeof(chunk) + chunk.stored_bytes > last){
+        break;
+      }
+      chunks.push_back(pos);
+      n_rec[chunk.id] += chunk.n_rec;
+      pos += sizeof(chunk) + chunk.stored_bytes;
+    }
+    end = pos;
+
+  }
+
+  ~trace_reader(){
+    release();
+  }
+
+  const trace_dims &dimensions() const {
+    return dims;
+  }
+
+  bool has(int id) const {
+    return (header.mask >> id) & 1u;
+  }
+
+  std::uint32_t mask() const {
+    return header.mask;
+  }
+
+  std::size_t records(int id) const {
+    return n_rec[id];
+  }
+
+  // End of the last complete chunk that was read
+  std::size_t indexed_bytes() const {
+    return end;
+  }
+
+  // Decode every record of a trace into out (records() * values(id) values)
+  void read(int id, double *out) const {
+
+    const std::size_t rec = dims.bytes(id);
+    const std::size_t n_val = dims.values(id);
+    std::vector<unsigned char> raw;
+
+    for(std::size_t c = 0; c < chunks.size(); ++c){
+      trace_chunk_header chunk;
+      std::memcpy(&chunk, data + chunks[c], sizeof(chunk));
+      if(static_cast<int>(chunk.id) != id){
+        continue;
+      }
+      const unsigned char *payload = data + chunks[c] + sizeof(chunk);
+      raw.resize(chunk.raw_bytes);
+      if(chunk.raw_bytes != chunk.n_rec * rec){
+        throw std::runtime_error("trace_reader: corrupted chunk.");
+      }
+      if(chunk.encoding == 1){
+        if(not rle_decode(payload, chunk.stored_bytes, &raw[0], raw.size())){
+          throw std::runtime_error("trace_reader: corrupted chunk.");
+        }
+        for(std::size_t b = rec; b < raw.size(); ++b){
+          raw[b] ^= raw[b - rec];
+        }
+      } else {
+        std::memcpy(&raw[0], payload, raw.size());
+      }
+
+      for(std::size_t r = 0; r < chunk.n_rec; ++r){
+        const unsigned char *x = &raw[r * rec];
+        for(std::size_t v = 0; v < n_val; ++v){
+          if(id == trace_assign){
+            std::uint16_t label;
+            std::memcpy(&label, x + 2 * v, 2);
+            out[v] = label;
+          } else if(id == trace_gamma){
+            out[v] = (x[v / 8] >> (v % 8)) & 1u;
+          } else {
+            std::memcpy(out + v, x + 8 * v, 8);
+          }
+        }
+        out += n_val;
+      }
+    }
+
+  }
+
+private:
+
+  const unsigned char *data;
+  std::size_t size;
+  std::size_t end;
+  std::vector<unsigned char> copy;
+  trace_file_header header;
+  trace_dims dims;
+  std::vector<std::size_t> chunks;
+  std::vector<std::size_t> n_rec;
+
+  void release(){
+#if !defined(_WIN32)
+    if(data != NULL){
+      ::munmap(const_cast<unsigned char *>(data), size);
+    }
+#endif
+    data = NULL;
+  }
+
+};
+
+inline trace_writer::trace_writer(const std::string &path,
+                                  const trace_dims &dims_,
+                                  std::uint32_t mask_, bool compress_,
+                                  const trace_position &pos,
+                                  std::size_t chunk_bytes):
+  dims(dims_), mask(mask_), compress(compress_), buffer(n_trace),
+  n_buffered(n_trace, 0), n_written(n_trace, 0), n_bytes(0),
+  chunk_rec(n_trace, 1), record(n_trace) {
+
+  /* Without a file at path, this starts a new one. An existing file must be
+     the trace of the chain, with the records of pos in its first pos.bytes
+     bytes; it is cut back to them and the new chunks go after them. */
+
+  setup(chunk_bytes);
+  std::FILE *old = std::fopen(path.c_str(), "rb");
+  if(old == NULL){
+    create(path);
+    return;
+  }
+  std::fclose(old);
+  if(pos.bytes == 0){
+    throw std::runtime_error("trace_writer: " + path + " exists, and the "
+                             "checkpoint has no trace to continue; give "
+                             "another file.");
+  }
+
+  // Check the records up to pos before cutting the file
+  {
+    trace_reader before(path, pos.bytes);
+    const trace_dims &d = before.dimensions();
+    bool same = (d.n == dims.n) and (d.p == dims.p) and
+      (d.K == dims.K) and (before.mask() == mask) and
+      (before.indexed_bytes() == pos.bytes);
+    for(int id = 0; same and (id < n_trace); ++id){
+      same = (not has(id)) or (before.records(id) == pos.records);
+    }
+    if(not same){
+      throw std::runtime_error("trace_writer: " + path + " is not the "
+                               "trace of the checkpoint, or was written "
+                               "with other traces.");
+    }
+  }
+
+#if defined(_WIN32)
+  file = std::fopen(path.c_str(), "r+b");
+  bool cut = (file != NULL) and
+    (_chsize_s(_fileno(file), pos.bytes) == 0) and
+    (std::fseek(file, 0, SEEK_END) == 0);
+#else
+  bool cut = ::truncate(path.c_str(), pos.bytes) == 0;
+  file = cut ? std::fopen(path.c_str(), "ab") : NULL;
+#endif
+  if((not cut) or (file == NULL)){
+    if(file != NULL){
+      std::fclose(file);
+      file = NULL;
+    }
+    throw std::runtime_error("trace_writer: cannot continue " + path);
+  }
+  for(int id = 0; id < n_trace; ++id){
+    n_written[id] = has(id) ? pos.records : 0;
+  }
+  n_bytes = pos.bytes;
+
+}
+
+#endif
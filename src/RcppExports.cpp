@@ -25,61 +25,61 @@ BEGIN_RCPP
 END_RCPP
 }
 // log_marginal
-double log_marginal(arma::vec zi, arma::vec gmi, arma::vec beta_k);
+double log_marginal(const arma::vec& zi, const arma::vec& gmi, const arma::vec& beta_k);
 RcppExport SEXP _ClusterZI_log_marginal(SEXP ziSEXP, SEXP gmiSEXP, SEXP beta_kSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< arma::vec >::type zi(ziSEXP);
-    Rcpp::traits::input_parameter< arma::vec >::type gmi(gmiSEXP);
-    Rcpp::traits::input_parameter< arma::vec >::type beta_k(beta_kSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type zi(ziSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type gmi(gmiSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type beta_k(beta_kSEXP);
     rcpp_result_gen = Rcpp::wrap(log_marginal(zi, gmi, beta_k));
     return rcpp_result_gen;
 END_RCPP
 }
 // realloc_sm
-arma::uvec realloc_sm(arma::mat z, arma::uvec clus_assign, arma::mat gamma_mat, arma::mat beta_mat, arma::uvec S, arma::uvec clus_sm);
+arma::uvec realloc_sm(const arma::mat& z, arma::uvec clus_assign, const arma::mat& gamma_mat, const arma::mat& beta_mat, const arma::uvec& S, const arma::uvec& clus_sm);
 RcppExport SEXP _ClusterZI_realloc_sm(SEXP zSEXP, SEXP clus_assignSEXP, SEXP gamma_matSEXP, SEXP beta_matSEXP, SEXP SSEXP, SEXP clus_smSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< arma::mat >::type z(zSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
     Rcpp::traits::input_parameter< arma::uvec >::type clus_assign(clus_assignSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type gamma_mat(gamma_matSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type beta_mat(beta_matSEXP);
-    Rcpp::traits::input_parameter< arma::uvec >::type S(SSEXP);
-    Rcpp::traits::input_parameter< arma::uvec >::type clus_sm(clus_smSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type gamma_mat(gamma_matSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type beta_mat(beta_matSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type S(SSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type clus_sm(clus_smSEXP);
     rcpp_result_gen = Rcpp::wrap(realloc_sm(z, clus_assign, gamma_mat, beta_mat, S, clus_sm));
     return rcpp_result_gen;
 END_RCPP
 }
 // log_proposal
-double log_proposal(arma::uvec clus_after, arma::uvec clus_before, arma::mat z, arma::mat gamma_mat, arma::mat beta_mat, arma::uvec S, arma::uvec clus_sm);
+double log_proposal(const arma::uvec& clus_after, const arma::uvec& clus_before, const arma::mat& z, const arma::mat& gamma_mat, const arma::mat& beta_mat, const arma::uvec& S, const arma::uvec& clus_sm);
 RcppExport SEXP _ClusterZI_log_proposal(SEXP clus_afterSEXP, SEXP clus_beforeSEXP, SEXP zSEXP, SEXP gamma_matSEXP, SEXP beta_matSEXP, SEXP SSEXP, SEXP clus_smSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< arma::uvec >::type clus_after(clus_afterSEXP);
-    Rcpp::traits::input_parameter< arma::uvec >::type clus_before(clus_beforeSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type z(zSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type gamma_mat(gamma_matSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type beta_mat(beta_matSEXP);
-    Rcpp::traits::input_parameter< arma::uvec >::type S(SSEXP);
-    Rcpp::traits::input_parameter< arma::uvec >::type clus_sm(clus_smSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type clus_after(clus_afterSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type clus_before(clus_beforeSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type gamma_mat(gamma_matSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type beta_mat(beta_matSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type S(SSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type clus_sm(clus_smSEXP);
     rcpp_result_gen = Rcpp::wrap(log_proposal(clus_after, clus_before, z, gamma_mat, beta_mat, S, clus_sm));
     return rcpp_result_gen;
 END_RCPP
 }
 // update_at_risk
-arma::mat update_at_risk(arma::mat z, arma::uvec clus_assign, arma::mat gamma_mat, arma::mat beta_mat, double r0g, double r1g);
+arma::mat update_at_risk(const arma::mat& z, const arma::uvec& clus_assign, const arma::mat& gamma_mat, const arma::mat& beta_mat, double r0g, double r1g);
 RcppExport SEXP _ClusterZI_update_at_risk(SEXP zSEXP, SEXP clus_assignSEXP, SEXP gamma_matSEXP, SEXP beta_matSEXP, SEXP r0gSEXP, SEXP r1gSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< arma::mat >::type z(zSEXP);
-    Rcpp::traits::input_parameter< arma::uvec >::type clus_assign(clus_assignSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type gamma_mat(gamma_matSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type beta_mat(beta_matSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type clus_assign(clus_assignSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type gamma_mat(gamma_matSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type beta_mat(beta_matSEXP);
     Rcpp::traits::input_parameter< double >::type r0g(r0gSEXP);
     Rcpp::traits::input_parameter< double >::type r1g(r1gSEXP);
     rcpp_result_gen = Rcpp::wrap(update_at_risk(z, clus_assign, gamma_mat, beta_mat, r0g, r1g));
@@ -87,14 +87,14 @@ BEGIN_RCPP
 END_RCPP
 }
 // update_beta
-arma::mat update_beta(arma::mat z, arma::uvec clus_assign, arma::mat gamma_mat, arma::mat beta_mat, double mu, double s2, double s2_MH);
+arma::mat update_beta(const arma::mat& z, const arma::uvec& clus_assign, const arma::mat& gamma_mat, arma::mat beta_mat, double mu, double s2, double s2_MH);
 RcppExport SEXP _ClusterZI_update_beta(SEXP zSEXP, SEXP clus_assignSEXP, SEXP gamma_matSEXP, SEXP beta_matSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP s2_MHSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< arma::mat >::type z(zSEXP);
-    Rcpp::traits::input_parameter< arma::uvec >::type clus_assign(clus_assignSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type gamma_mat(gamma_matSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type clus_assign(clus_assignSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type gamma_mat(gamma_matSEXP);
     Rcpp::traits::input_parameter< arma::mat >::type beta_mat(beta_matSEXP);
     Rcpp::traits::input_parameter< double >::type mu(muSEXP);
     Rcpp::traits::input_parameter< double >::type s2(s2SEXP);
@@ -104,34 +104,50 @@ BEGIN_RCPP
 END_RCPP
 }
 // realloc
-Rcpp::List realloc(arma::mat z, arma::uvec clus_assign, arma::mat gamma_mat, arma::mat beta_mat, arma::vec tau_vec, arma::vec theta_vec);
+Rcpp::List realloc(const arma::mat& z, arma::uvec clus_assign, const arma::mat& gamma_mat, arma::mat beta_mat, arma::vec tau_vec, const arma::vec& theta_vec);
 RcppExport SEXP _ClusterZI_realloc(SEXP zSEXP, SEXP clus_assignSEXP, SEXP gamma_matSEXP, SEXP beta_matSEXP, SEXP tau_vecSEXP, SEXP theta_vecSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< arma::mat >::type z(zSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
     Rcpp::traits::input_parameter< arma::uvec >::type clus_assign(clus_assignSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type gamma_mat(gamma_matSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type gamma_mat(gamma_matSEXP);
     Rcpp::traits::input_parameter< arma::mat >::type beta_mat(beta_matSEXP);
     Rcpp::traits::input_parameter< arma::vec >::type tau_vec(tau_vecSEXP);
-    Rcpp::traits::input_parameter< arma::vec >::type theta_vec(theta_vecSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type theta_vec(theta_vecSEXP);
     rcpp_result_gen = Rcpp::wrap(realloc(z, clus_assign, gamma_mat, beta_mat, tau_vec, theta_vec));
     return rcpp_result_gen;
 END_RCPP
 }
+// realloc_blocked
+Rcpp::List realloc_blocked(const arma::mat& z, arma::uvec clus_assign, const arma::mat& gamma_mat, arma::mat beta_mat, arma::vec tau_vec, unsigned int n_threads);
+RcppExport SEXP _ClusterZI_realloc_blocked(SEXP zSEXP, SEXP clus_assignSEXP, SEXP gamma_matSEXP, SEXP beta_matSEXP, SEXP tau_vecSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
+    Rcpp::traits::input_parameter< arma::uvec >::type clus_assign(clus_assignSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type gamma_mat(gamma_matSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type beta_mat(beta_matSEXP);
+    Rcpp::traits::input_parameter< arma::vec >::type tau_vec(tau_vecSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(realloc_blocked(z, clus_assign, gamma_mat, beta_mat, tau_vec, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
 // sm
-Rcpp::List sm(unsigned int K_max, arma::mat z, arma::uvec clus_assign, arma::mat gamma_mat, arma::mat beta_mat, arma::vec tau_vec, arma::vec theta_vec, unsigned int launch_iter, double mu, double s2, double r0c, double r1c);
+Rcpp::List sm(unsigned int K_max, const arma::mat& z, arma::uvec clus_assign, const arma::mat& gamma_mat, arma::mat beta_mat, arma::vec tau_vec, const arma::vec& theta_vec, unsigned int launch_iter, double mu, double s2, double r0c, double r1c);
 RcppExport SEXP _ClusterZI_sm(SEXP K_maxSEXP, SEXP zSEXP, SEXP clus_assignSEXP, SEXP gamma_matSEXP, SEXP beta_matSEXP, SEXP tau_vecSEXP, SEXP theta_vecSEXP, SEXP launch_iterSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP r0cSEXP, SEXP r1cSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< unsigned int >::type K_max(K_maxSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type z(zSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
     Rcpp::traits::input_parameter< arma::uvec >::type clus_assign(clus_assignSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type gamma_mat(gamma_matSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type gamma_mat(gamma_matSEXP);
     Rcpp::traits::input_parameter< arma::mat >::type beta_mat(beta_matSEXP);
     Rcpp::traits::input_parameter< arma::vec >::type tau_vec(tau_vecSEXP);
-    Rcpp::traits::input_parameter< arma::vec >::type theta_vec(theta_vecSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type theta_vec(theta_vecSEXP);
     Rcpp::traits::input_parameter< unsigned int >::type launch_iter(launch_iterSEXP);
     Rcpp::traits::input_parameter< double >::type mu(muSEXP);
     Rcpp::traits::input_parameter< double >::type s2(s2SEXP);
@@ -142,47 +158,50 @@ BEGIN_RCPP
 END_RCPP
 }
 // update_tau
-Rcpp::List update_tau(arma::uvec clus_assign, arma::vec tau_vec, arma::vec theta_vec, double U);
+Rcpp::List update_tau(const arma::uvec& clus_assign, arma::vec tau_vec, const arma::vec& theta_vec, double U);
 RcppExport SEXP _ClusterZI_update_tau(SEXP clus_assignSEXP, SEXP tau_vecSEXP, SEXP theta_vecSEXP, SEXP USEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< arma::uvec >::type clus_assign(clus_assignSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type clus_assign(clus_assignSEXP);
     Rcpp::traits::input_parameter< arma::vec >::type tau_vec(tau_vecSEXP);
-    Rcpp::traits::input_parameter< arma::vec >::type theta_vec(theta_vecSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type theta_vec(theta_vecSEXP);
     Rcpp::traits::input_parameter< double >::type U(USEXP);
     rcpp_result_gen = Rcpp::wrap(update_tau(clus_assign, tau_vec, theta_vec, U));
     return rcpp_result_gen;
 END_RCPP
 }
 // DM_DM
-arma::mat DM_DM(unsigned int iter, unsigned int K_max, arma::mat z, arma::vec theta_vec, double MH_var, double mu, double s2, int print_iter);
-RcppExport SEXP _ClusterZI_DM_DM(SEXP iterSEXP, SEXP K_maxSEXP, SEXP zSEXP, SEXP theta_vecSEXP, SEXP MH_varSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP print_iterSEXP) {
+arma::mat DM_DM(unsigned int iter, unsigned int K_max, const arma::mat& z, const arma::vec& theta_vec, double MH_var, double mu, double s2, int print_iter, unsigned int burn_in, unsigned int thin, unsigned int beta_block);
+RcppExport SEXP _ClusterZI_DM_DM(SEXP iterSEXP, SEXP K_maxSEXP, SEXP zSEXP, SEXP theta_vecSEXP, SEXP MH_varSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP print_iterSEXP, SEXP burn_inSEXP, SEXP thinSEXP, SEXP beta_blockSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< unsigned int >::type iter(iterSEXP);
     Rcpp::traits::input_parameter< unsigned int >::type K_max(K_maxSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type z(zSEXP);
-    Rcpp::traits::input_parameter< arma::vec >::type theta_vec(theta_vecSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type theta_vec(theta_vecSEXP);
     Rcpp::traits::input_parameter< double >::type MH_var(MH_varSEXP);
     Rcpp::traits::input_parameter< double >::type mu(muSEXP);
     Rcpp::traits::input_parameter< double >::type s2(s2SEXP);
     Rcpp::traits::input_parameter< int >::type print_iter(print_iterSEXP);
-    rcpp_result_gen = Rcpp::wrap(DM_DM(iter, K_max, z, theta_vec, MH_var, mu, s2, print_iter));
+    Rcpp::traits::input_parameter< unsigned int >::type burn_in(burn_inSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type thin(thinSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type beta_block(beta_blockSEXP);
+    rcpp_result_gen = Rcpp::wrap(DM_DM(iter, K_max, z, theta_vec, MH_var, mu, s2, print_iter, burn_in, thin, beta_block));
     return rcpp_result_gen;
 END_RCPP
 }
 // DM_ZIDM
-Rcpp::List DM_ZIDM(unsigned int iter, unsigned int K_max, arma::mat z, arma::vec theta_vec, unsigned int launch_iter, double MH_var, double mu, double s2, double r0c, double r1c, int print_iter);
-RcppExport SEXP _ClusterZI_DM_ZIDM(SEXP iterSEXP, SEXP K_maxSEXP, SEXP zSEXP, SEXP theta_vecSEXP, SEXP launch_iterSEXP, SEXP MH_varSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP r0cSEXP, SEXP r1cSEXP, SEXP print_iterSEXP) {
+Rcpp::List DM_ZIDM(unsigned int iter, unsigned int K_max, const arma::mat& z, const arma::vec& theta_vec, unsigned int launch_iter, double MH_var, double mu, double s2, double r0c, double r1c, int print_iter, unsigned int burn_in, unsigned int thin, Rcpp::CharacterVector out_traces, std::string out_file, bool compress, std::string realloc_mode, unsigned int n_threads, unsigned int sm_attempts, std::string sm_schedule, unsigned int sm_every, bool MH_adapt, unsigned int beta_block, bool profile, bool psm, std::string point_loss);
+RcppExport SEXP _ClusterZI_DM_ZIDM(SEXP iterSEXP, SEXP K_maxSEXP, SEXP zSEXP, SEXP theta_vecSEXP, SEXP launch_iterSEXP, SEXP MH_varSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP r0cSEXP, SEXP r1cSEXP, SEXP print_iterSEXP, SEXP burn_inSEXP, SEXP thinSEXP, SEXP out_tracesSEXP, SEXP out_fileSEXP, SEXP compressSEXP, SEXP realloc_modeSEXP, SEXP n_threadsSEXP, SEXP sm_attemptsSEXP, SEXP sm_scheduleSEXP, SEXP sm_everySEXP, SEXP MH_adaptSEXP, SEXP beta_blockSEXP, SEXP profileSEXP, SEXP psmSEXP, SEXP point_lossSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< unsigned int >::type iter(iterSEXP);
     Rcpp::traits::input_parameter< unsigned int >::type K_max(K_maxSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type z(zSEXP);
-    Rcpp::traits::input_parameter< arma::vec >::type theta_vec(theta_vecSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type theta_vec(theta_vecSEXP);
     Rcpp::traits::input_parameter< unsigned int >::type launch_iter(launch_iterSEXP);
     Rcpp::traits::input_parameter< double >::type MH_var(MH_varSEXP);
     Rcpp::traits::input_parameter< double >::type mu(muSEXP);
@@ -190,20 +209,35 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< double >::type r0c(r0cSEXP);
     Rcpp::traits::input_parameter< double >::type r1c(r1cSEXP);
     Rcpp::traits::input_parameter< int >::type print_iter(print_iterSEXP);
-    rcpp_result_gen = Rcpp::wrap(DM_ZIDM(iter, K_max, z, theta_vec, launch_iter, MH_var, mu, s2, r0c, r1c, print_iter));
+    Rcpp::traits::input_parameter< unsigned int >::type burn_in(burn_inSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type thin(thinSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type out_traces(out_tracesSEXP);
+    Rcpp::traits::input_parameter< std::string >::type out_file(out_fileSEXP);
+    Rcpp::traits::input_parameter< bool >::type compress(compressSEXP);
+    Rcpp::traits::input_parameter< std::string >::type realloc_mode(realloc_modeSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type sm_attempts(sm_attemptsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type sm_schedule(sm_scheduleSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type sm_every(sm_everySEXP);
+    Rcpp::traits::input_parameter< bool >::type MH_adapt(MH_adaptSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type beta_block(beta_blockSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    Rcpp::traits::input_parameter< bool >::type psm(psmSEXP);
+    Rcpp::traits::input_parameter< std::string >::type point_loss(point_lossSEXP);
+    rcpp_result_gen = Rcpp::wrap(DM_ZIDM(iter, K_max, z, theta_vec, launch_iter, MH_var, mu, s2, r0c, r1c, print_iter, burn_in, thin, out_traces, out_file, compress, realloc_mode, n_threads, sm_attempts, sm_schedule, sm_every, MH_adapt, beta_block, profile, psm, point_loss));
     return rcpp_result_gen;
 END_RCPP
 }
 // ZIDM_ZIDM
-Rcpp::List ZIDM_ZIDM(unsigned int iter, unsigned int K_max, arma::mat z, arma::vec theta_vec, unsigned int launch_iter, double MH_var, double mu, double s2, double r0g, double r1g, double r0c, double r1c, int print_iter);
-RcppExport SEXP _ClusterZI_ZIDM_ZIDM(SEXP iterSEXP, SEXP K_maxSEXP, SEXP zSEXP, SEXP theta_vecSEXP, SEXP launch_iterSEXP, SEXP MH_varSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP r0gSEXP, SEXP r1gSEXP, SEXP r0cSEXP, SEXP r1cSEXP, SEXP print_iterSEXP) {
+Rcpp::List ZIDM_ZIDM(unsigned int iter, unsigned int K_max, const arma::mat& z, const arma::vec& theta_vec, unsigned int launch_iter, double MH_var, double mu, double s2, double r0g, double r1g, double r0c, double r1c, int print_iter, unsigned int burn_in, unsigned int thin, Rcpp::CharacterVector out_traces, std::string out_file, bool compress, std::string realloc_mode, unsigned int n_threads, unsigned int sm_attempts, std::string sm_schedule, unsigned int sm_every, bool MH_adapt, unsigned int beta_block, bool profile, bool psm, std::string point_loss, std::string checkpoint_file, unsigned int checkpoint_every);
+RcppExport SEXP _ClusterZI_ZIDM_ZIDM(SEXP iterSEXP, SEXP K_maxSEXP, SEXP zSEXP, SEXP theta_vecSEXP, SEXP launch_iterSEXP, SEXP MH_varSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP r0gSEXP, SEXP r1gSEXP, SEXP r0cSEXP, SEXP r1cSEXP, SEXP print_iterSEXP, SEXP burn_inSEXP, SEXP thinSEXP, SEXP out_tracesSEXP, SEXP out_fileSEXP, SEXP compressSEXP, SEXP realloc_modeSEXP, SEXP n_threadsSEXP, SEXP sm_attemptsSEXP, SEXP sm_scheduleSEXP, SEXP sm_everySEXP, SEXP MH_adaptSEXP, SEXP beta_blockSEXP, SEXP profileSEXP, SEXP psmSEXP, SEXP point_lossSEXP, SEXP checkpoint_fileSEXP, SEXP checkpoint_everySEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< unsigned int >::type iter(iterSEXP);
     Rcpp::traits::input_parameter< unsigned int >::type K_max(K_maxSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type z(zSEXP);
-    Rcpp::traits::input_parameter< arma::vec >::type theta_vec(theta_vecSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type theta_vec(theta_vecSEXP);
     Rcpp::traits::input_parameter< unsigned int >::type launch_iter(launch_iterSEXP);
     Rcpp::traits::input_parameter< double >::type MH_var(MH_varSEXP);
     Rcpp::traits::input_parameter< double >::type mu(muSEXP);
@@ -213,43 +247,154 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< double >::type r0c(r0cSEXP);
     Rcpp::traits::input_parameter< double >::type r1c(r1cSEXP);
     Rcpp::traits::input_parameter< int >::type print_iter(print_iterSEXP);
-    rcpp_result_gen = Rcpp::wrap(ZIDM_ZIDM(iter, K_max, z, theta_vec, launch_iter, MH_var, mu, s2, r0g, r1g, r0c, r1c, print_iter));
+    Rcpp::traits::input_parameter< unsigned int >::type burn_in(burn_inSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type thin(thinSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type out_traces(out_tracesSEXP);
+    Rcpp::traits::input_parameter< std::string >::type out_file(out_fileSEXP);
+    Rcpp::traits::input_parameter< bool >::type compress(compressSEXP);
+    Rcpp::traits::input_parameter< std::string >::type realloc_mode(realloc_modeSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type sm_attempts(sm_attemptsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type sm_schedule(sm_scheduleSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type sm_every(sm_everySEXP);
+    Rcpp::traits::input_parameter< bool >::type MH_adapt(MH_adaptSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type beta_block(beta_blockSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    Rcpp::traits::input_parameter< bool >::type psm(psmSEXP);
+    Rcpp::traits::input_parameter< std::string >::type point_loss(point_lossSEXP);
+    Rcpp::traits::input_parameter< std::string >::type checkpoint_file(checkpoint_fileSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type checkpoint_every(checkpoint_everySEXP);
+    rcpp_result_gen = Rcpp::wrap(ZIDM_ZIDM(iter, K_max, z, theta_vec, launch_iter, MH_var, mu, s2, r0g, r1g, r0c, r1c, print_iter, burn_in, thin, out_traces, out_file, compress, realloc_mode, n_threads, sm_attempts, sm_schedule, sm_every, MH_adapt, beta_block, profile, psm, point_loss, checkpoint_file, checkpoint_every));
+    return rcpp_result_gen;
+END_RCPP
+}
+// ZIDM_ZIDM_resume
+Rcpp::List ZIDM_ZIDM_resume(std::string checkpoint_file, unsigned int iter, const arma::mat& z, const arma::vec& theta_vec, unsigned int launch_iter, double MH_var, double mu, double s2, double r0g, double r1g, double r0c, double r1c, int print_iter, unsigned int burn_in, unsigned int thin, Rcpp::CharacterVector out_traces, std::string out_file, bool compress, std::string realloc_mode, unsigned int n_threads, unsigned int sm_attempts, std::string sm_schedule, unsigned int sm_every, bool MH_adapt, unsigned int beta_block, bool profile, bool psm, std::string point_loss, unsigned int checkpoint_every);
+RcppExport SEXP _ClusterZI_ZIDM_ZIDM_resume(SEXP checkpoint_fileSEXP, SEXP iterSEXP, SEXP zSEXP, SEXP theta_vecSEXP, SEXP launch_iterSEXP, SEXP MH_varSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP r0gSEXP, SEXP r1gSEXP, SEXP r0cSEXP, SEXP r1cSEXP, SEXP print_iterSEXP, SEXP burn_inSEXP, SEXP thinSEXP, SEXP out_tracesSEXP, SEXP out_fileSEXP, SEXP compressSEXP, SEXP realloc_modeSEXP, SEXP n_threadsSEXP, SEXP sm_attemptsSEXP, SEXP sm_scheduleSEXP, SEXP sm_everySEXP, SEXP MH_adaptSEXP, SEXP beta_blockSEXP, SEXP profileSEXP, SEXP psmSEXP, SEXP point_lossSEXP, SEXP checkpoint_everySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type checkpoint_file(checkpoint_fileSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type iter(iterSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type theta_vec(theta_vecSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type launch_iter(launch_iterSEXP);
+    Rcpp::traits::input_parameter< double >::type MH_var(MH_varSEXP);
+    Rcpp::traits::input_parameter< double >::type mu(muSEXP);
+    Rcpp::traits::input_parameter< double >::type s2(s2SEXP);
+    Rcpp::traits::input_parameter< double >::type r0g(r0gSEXP);
+    Rcpp::traits::input_parameter< double >::type r1g(r1gSEXP);
+    Rcpp::traits::input_parameter< double >::type r0c(r0cSEXP);
+    Rcpp::traits::input_parameter< double >::type r1c(r1cSEXP);
+    Rcpp::traits::input_parameter< int >::type print_iter(print_iterSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type burn_in(burn_inSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type thin(thinSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type out_traces(out_tracesSEXP);
+    Rcpp::traits::input_parameter< std::string >::type out_file(out_fileSEXP);
+    Rcpp::traits::input_parameter< bool >::type compress(compressSEXP);
+    Rcpp::traits::input_parameter< std::string >::type realloc_mode(realloc_modeSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type sm_attempts(sm_attemptsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type sm_schedule(sm_scheduleSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type sm_every(sm_everySEXP);
+    Rcpp::traits::input_parameter< bool >::type MH_adapt(MH_adaptSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type beta_block(beta_blockSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    Rcpp::traits::input_parameter< bool >::type psm(psmSEXP);
+    Rcpp::traits::input_parameter< std::string >::type point_loss(point_lossSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type checkpoint_every(checkpoint_everySEXP);
+    rcpp_result_gen = Rcpp::wrap(ZIDM_ZIDM_resume(checkpoint_file, iter, z, theta_vec, launch_iter, MH_var, mu, s2, r0g, r1g, r0c, r1c, print_iter, burn_in, thin, out_traces, out_file, compress, realloc_mode, n_threads, sm_attempts, sm_schedule, sm_every, MH_adapt, beta_block, profile, psm, point_loss, checkpoint_every));
+    return rcpp_result_gen;
+END_RCPP
+}
+// multi_chain
+Rcpp::List multi_chain(unsigned int n_chains, std::string model, unsigned int iter, unsigned int K_max, const arma::mat& z, const arma::vec& theta_vec, unsigned int launch_iter, double MH_var, double mu, double s2, double r0g, double r1g, double r0c, double r1c, unsigned int burn_in, unsigned int thin, std::string realloc_mode, unsigned int n_threads, unsigned int sm_attempts, std::string sm_schedule, unsigned int sm_every, bool MH_adapt, unsigned int beta_block, bool profile, bool psm, std::string point_loss);
+RcppExport SEXP _ClusterZI_multi_chain(SEXP n_chainsSEXP, SEXP modelSEXP, SEXP iterSEXP, SEXP K_maxSEXP, SEXP zSEXP, SEXP theta_vecSEXP, SEXP launch_iterSEXP, SEXP MH_varSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP r0gSEXP, SEXP r1gSEXP, SEXP r0cSEXP, SEXP r1cSEXP, SEXP burn_inSEXP, SEXP thinSEXP, SEXP realloc_modeSEXP, SEXP n_threadsSEXP, SEXP sm_attemptsSEXP, SEXP sm_scheduleSEXP, SEXP sm_everySEXP, SEXP MH_adaptSEXP, SEXP beta_blockSEXP, SEXP profileSEXP, SEXP psmSEXP, SEXP point_lossSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< unsigned int >::type n_chains(n_chainsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type model(modelSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type iter(iterSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type K_max(K_maxSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type theta_vec(theta_vecSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type launch_iter(launch_iterSEXP);
+    Rcpp::traits::input_parameter< double >::type MH_var(MH_varSEXP);
+    Rcpp::traits::input_parameter< double >::type mu(muSEXP);
+    Rcpp::traits::input_parameter< double >::type s2(s2SEXP);
+    Rcpp::traits::input_parameter< double >::type r0g(r0gSEXP);
+    Rcpp::traits::input_parameter< double >::type r1g(r1gSEXP);
+    Rcpp::traits::input_parameter< double >::type r0c(r0cSEXP);
+    Rcpp::traits::input_parameter< double >::type r1c(r1cSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type burn_in(burn_inSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type thin(thinSEXP);
+    Rcpp::traits::input_parameter< std::string >::type realloc_mode(realloc_modeSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type sm_attempts(sm_attemptsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type sm_schedule(sm_scheduleSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type sm_every(sm_everySEXP);
+    Rcpp::traits::input_parameter< bool >::type MH_adapt(MH_adaptSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type beta_block(beta_blockSEXP);
+    Rcpp::traits::input_parameter< bool >::type profile(profileSEXP);
+    Rcpp::traits::input_parameter< bool >::type psm(psmSEXP);
+    Rcpp::traits::input_parameter< std::string >::type point_loss(point_lossSEXP);
+    rcpp_result_gen = Rcpp::wrap(multi_chain(n_chains, model, iter, K_max, z, theta_vec, launch_iter, MH_var, mu, s2, r0g, r1g, r0c, r1c, burn_in, thin, realloc_mode, n_threads, sm_attempts, sm_schedule, sm_every, MH_adapt, beta_block, profile, psm, point_loss));
+    return rcpp_result_gen;
+END_RCPP
+}
+// read_trace
+SEXP read_trace(std::string file, std::string trace);
+RcppExport SEXP _ClusterZI_read_trace(SEXP fileSEXP, SEXP traceSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type file(fileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type trace(traceSEXP);
+    rcpp_result_gen = Rcpp::wrap(read_trace(file, trace));
     return rcpp_result_gen;
 END_RCPP
 }
 // beta_mat_update
-arma::cube beta_mat_update(unsigned int K, unsigned int iter, arma::mat z, arma::uvec clus_assign, double mu, double s2, double s2_MH);
-RcppExport SEXP _ClusterZI_beta_mat_update(SEXP KSEXP, SEXP iterSEXP, SEXP zSEXP, SEXP clus_assignSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP s2_MHSEXP) {
+arma::cube beta_mat_update(unsigned int K, unsigned int iter, const arma::mat& z, const arma::uvec& clus_assign, double mu, double s2, double s2_MH, unsigned int burn_in, unsigned int thin, unsigned int beta_block);
+RcppExport SEXP _ClusterZI_beta_mat_update(SEXP KSEXP, SEXP iterSEXP, SEXP zSEXP, SEXP clus_assignSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP s2_MHSEXP, SEXP burn_inSEXP, SEXP thinSEXP, SEXP beta_blockSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< unsigned int >::type K(KSEXP);
     Rcpp::traits::input_parameter< unsigned int >::type iter(iterSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type z(zSEXP);
-    Rcpp::traits::input_parameter< arma::uvec >::type clus_assign(clus_assignSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type clus_assign(clus_assignSEXP);
     Rcpp::traits::input_parameter< double >::type mu(muSEXP);
     Rcpp::traits::input_parameter< double >::type s2(s2SEXP);
     Rcpp::traits::input_parameter< double >::type s2_MH(s2_MHSEXP);
-    rcpp_result_gen = Rcpp::wrap(beta_mat_update(K, iter, z, clus_assign, mu, s2, s2_MH));
+    Rcpp::traits::input_parameter< unsigned int >::type burn_in(burn_inSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type thin(thinSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type beta_block(beta_blockSEXP);
+    rcpp_result_gen = Rcpp::wrap(beta_mat_update(K, iter, z, clus_assign, mu, s2, s2_MH, burn_in, thin, beta_block));
     return rcpp_result_gen;
 END_RCPP
 }
 // beta_ar_update
-Rcpp::List beta_ar_update(unsigned int K, unsigned int iter, arma::mat z, arma::uvec clus_assign, double r0g, double r1g, double mu, double s2, double s2_MH);
-RcppExport SEXP _ClusterZI_beta_ar_update(SEXP KSEXP, SEXP iterSEXP, SEXP zSEXP, SEXP clus_assignSEXP, SEXP r0gSEXP, SEXP r1gSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP s2_MHSEXP) {
+Rcpp::List beta_ar_update(unsigned int K, unsigned int iter, const arma::mat& z, const arma::uvec& clus_assign, double r0g, double r1g, double mu, double s2, double s2_MH, unsigned int burn_in, unsigned int thin, Rcpp::CharacterVector out_traces, unsigned int n_threads);
+RcppExport SEXP _ClusterZI_beta_ar_update(SEXP KSEXP, SEXP iterSEXP, SEXP zSEXP, SEXP clus_assignSEXP, SEXP r0gSEXP, SEXP r1gSEXP, SEXP muSEXP, SEXP s2SEXP, SEXP s2_MHSEXP, SEXP burn_inSEXP, SEXP thinSEXP, SEXP out_tracesSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< unsigned int >::type K(KSEXP);
     Rcpp::traits::input_parameter< unsigned int >::type iter(iterSEXP);
-    Rcpp::traits::input_parameter< arma::mat >::type z(zSEXP);
-    Rcpp::traits::input_parameter< arma::uvec >::type clus_assign(clus_assignSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type z(zSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type clus_assign(clus_assignSEXP);
     Rcpp::traits::input_parameter< double >::type r0g(r0gSEXP);
     Rcpp::traits::input_parameter< double >::type r1g(r1gSEXP);
     Rcpp::traits::input_parameter< double >::type mu(muSEXP);
     Rcpp::traits::input_parameter< double >::type s2(s2SEXP);
     Rcpp::traits::input_parameter< double >::type s2_MH(s2_MHSEXP);
-    rcpp_result_gen = Rcpp::wrap(beta_ar_update(K, iter, z, clus_assign, r0g, r1g, mu, s2, s2_MH));
+    Rcpp::traits::input_parameter< unsigned int >::type burn_in(burn_inSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type thin(thinSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type out_traces(out_tracesSEXP);
+    Rcpp::traits::input_parameter< unsigned int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(beta_ar_update(K, iter, z, clus_assign, r0g, r1g, mu, s2, s2_MH, burn_in, thin, out_traces, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -305,13 +450,17 @@ static const R_CallMethodDef CallEntries[] = {
     {"_ClusterZI_update_at_risk", (DL_FUNC) &_ClusterZI_update_at_risk, 6},
     {"_ClusterZI_update_beta", (DL_FUNC) &_ClusterZI_update_beta, 7},
     {"_ClusterZI_realloc", (DL_FUNC) &_ClusterZI_realloc, 6},
+    {"_ClusterZI_realloc_blocked", (DL_FUNC) &_ClusterZI_realloc_blocked, 6},
     {"_ClusterZI_sm", (DL_FUNC) &_ClusterZI_sm, 12},
     {"_ClusterZI_update_tau", (DL_FUNC) &_ClusterZI_update_tau, 4},
-    {"_ClusterZI_DM_DM", (DL_FUNC) &_ClusterZI_DM_DM, 8},
-    {"_ClusterZI_DM_ZIDM", (DL_FUNC) &_ClusterZI_DM_ZIDM, 11},
-    {"_ClusterZI_ZIDM_ZIDM", (DL_FUNC) &_ClusterZI_ZIDM_ZIDM, 13},
-    {"_ClusterZI_beta_mat_update", (DL_FUNC) &_ClusterZI_beta_mat_update, 7},
-    {"_ClusterZI_beta_ar_update", (DL_FUNC) &_ClusterZI_beta_ar_update, 9},
+    {"_ClusterZI_DM_DM", (DL_FUNC) &_ClusterZI_DM_DM, 11},
+    {"_ClusterZI_DM_ZIDM", (DL_FUNC) &_ClusterZI_DM_ZIDM, 26},
+    {"_ClusterZI_ZIDM_ZIDM", (DL_FUNC) &_ClusterZI_ZIDM_ZIDM, 30},
+    {"_ClusterZI_ZIDM_ZIDM_resume", (DL_FUNC) &_ClusterZI_ZIDM_ZIDM_resume, 29},
+    {"_ClusterZI_multi_chain", (DL_FUNC) &_ClusterZI_multi_chain, 26},
+    {"_ClusterZI_read_trace", (DL_FUNC) &_ClusterZI_read_trace, 2},
+    {"_ClusterZI_beta_mat_update", (DL_FUNC) &_ClusterZI_beta_mat_update, 10},
+    {"_ClusterZI_beta_ar_update", (DL_FUNC) &_ClusterZI_beta_ar_update, 13},
     {"_ClusterZI_rcpparma_hello_world", (DL_FUNC) &_ClusterZI_rcpparma_hello_world, 0},
     {"_ClusterZI_rcpparma_outerproduct", (DL_FUNC) &_ClusterZI_rcpparma_outerproduct, 1},
     {"_ClusterZI_rcpparma_innerproduct", (DL_FUNC) &_ClusterZI_rcpparma_innerproduct, 1},
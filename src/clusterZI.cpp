@@ -1,20 +1,12 @@
 #include "RcppArmadillo.h"
+#include "ClusterZI/zidm_api.h"
+#include "ClusterZI/zidm_diagnostics.h"
+#include <exception>
 
 // [[Rcpp::depends(RcppArmadillo)]]
 
 #define pi 3.141592653589793238462643383280
 
-Rcpp::IntegerVector rmultinom_1(Rcpp::NumericVector &probs, unsigned int &N){
-  
-  /* Description: sample from the multinomial(N, probs).
-   * Credit: https://gallery.rcpp.org/articles/recreating-rmultinom-and-rpois-with-rcpp/
-   */
-  
-  Rcpp::IntegerVector outcome(N);
-  rmultinom(1, probs.begin(), N, outcome.begin());
-  return outcome;
-}
-
 arma::vec log_sum_exp(arma::vec log_unnorm_prob){
   
   /* Description: This function will calculate the normalized probability 
@@ -38,29 +30,41 @@ arma::vec log_sum_exp(arma::vec log_unnorm_prob){
   return log_unnorm_prob/arma::accu(log_unnorm_prob);
 }
 
+void adjust_tau_beta(const arma::uvec &clus_assign, arma::vec &tau_vec, 
+                     arma::mat &beta_mat){
+  
+  /* Adjust tau and beta in place: let it be 0 for inactive cluster */
+  
+  arma::uvec is_active(tau_vec.size(), arma::fill::zeros);
+  is_active.elem(clus_assign).fill(1);
+  
+  for(unsigned int k = 0; k < tau_vec.size(); ++k){
+    if(is_active[k] == 0){
+      tau_vec[k] = 0.0;
+      beta_mat.row(k).zeros();
+    }
+  }
+  
+}
+
 // [[Rcpp::export]]
 Rcpp::List adjust_tau_beta(arma::mat beta_mat, arma::vec tau_vec,
                            arma::uvec clus_assign){
   
   /* Adjust tau and beta: let it be 0 for inactive cluster */
   
-  arma::uvec active_clus = arma::unique(clus_assign);
-  
-  arma::vec new_tau_vec(tau_vec.size(), arma::fill::zeros);
-  arma::mat new_beta_mat(beta_mat.n_rows, beta_mat.n_cols, arma::fill::zeros);
-  
-  new_tau_vec.elem(active_clus) = tau_vec.elem(active_clus);
-  new_beta_mat.rows(active_clus) = beta_mat.rows(active_clus);
+  adjust_tau_beta(clus_assign, tau_vec, beta_mat);
   
   Rcpp::List result;
-  result["tau"] = new_tau_vec;
-  result["beta"] = new_beta_mat;
+  result["tau"] = tau_vec;
+  result["beta"] = beta_mat;
   return result;
   
 }
 
 // [[Rcpp::export]]
-double log_marginal(arma::vec zi, arma::vec gmi, arma::vec beta_k){
+double log_marginal(const arma::vec &zi, const arma::vec &gmi, 
+                    const arma::vec &beta_k){
   
   /* Calculate the proportional of the marginal probability in a log scale. */
   
@@ -73,727 +77,767 @@ double log_marginal(arma::vec zi, arma::vec gmi, arma::vec beta_k){
   result -= arma::accu(arma::lgamma(xi_k.rows(gm1)));
   result += arma::accu(arma::lgamma(zi.rows(gm1) + xi_k.rows(gm1)));
   result -= std::lgamma(arma::accu(zi.rows(gm1) + xi_k.rows(gm1)));
-    
+  
   return result;
   
 }
 
-// [[Rcpp::export]]
-arma::uvec realloc_sm(arma::mat z, arma::uvec clus_assign, arma::mat gamma_mat, 
-                      arma::mat beta_mat, arma::uvec S, arma::uvec clus_sm){
-  
-  /* Reallocation algorithm for the split merge */
+std::uint64_t draw_seed(){
   
-  arma::uvec new_assign(clus_assign); 
-  arma::vec nk(2, arma::fill::zeros);
-  unsigned int K_sm = clus_sm.size();
+  /* Draw a 64-bit seed for the counter-based streams from R's RNG, so that 
+     set.seed() still controls the whole chain. */
   
-  for(int ss = 0; ss < S.size(); ++ss){
-    int s = S[ss];
-    arma::uvec n_index = arma::find(clus_sm == new_assign[s]);
-    nk[n_index[0]] += 1;
-  }
+  std::uint64_t hi = R::runif(0.0, 1.0) * 4294967296.0;
+  std::uint64_t lo = R::runif(0.0, 1.0) * 4294967296.0;
+  return (hi << 32) ^ lo;
   
-  for(int ss = 0; ss < S.size(); ++ss){
-
-    int s = S[ss];
-    arma::uvec n_index = arma::find(clus_sm == new_assign[s]);
-    nk[n_index[0]] -= 1;
-
-    arma::vec zs = z.row(s).t();
-    arma::vec gms = gamma_mat.row(s).t();
-    arma::vec log_prob(2, arma::fill::zeros);
-
-    for(int kk = 0; kk <= 1; ++kk){
-      int k = clus_sm[kk];
-      log_prob[kk] += log_marginal(zs, gms, beta_mat.row(k).t());
-      log_prob[kk] += std::log(nk[kk]);
-    }
-
-    arma::vec realloc_prob = log_sum_exp(log_prob);
-    Rcpp::NumericVector realloc_rcpp = Rcpp::NumericVector(realloc_prob.begin(),
-                                                           realloc_prob.end());
-    Rcpp::IntegerVector realloc_rcpp_index = rmultinom_1(realloc_rcpp, K_sm);
-    arma::vec realloc_index = Rcpp::as<arma::vec>(Rcpp::wrap(realloc_rcpp_index));
-
-    // New assign
-    arma::uvec new_ck = arma::find(realloc_index == 1);
-    new_assign.row(s).fill(clus_sm[new_ck[0]]);
-
-    nk[new_ck[0]] += 1;
+}
 
-  }
-  
-  return new_assign;
-  
+// [[Rcpp::export]]
+arma::uvec realloc_sm(const arma::mat &z, arma::uvec clus_assign, 
+                      const arma::mat &gamma_mat, const arma::mat &beta_mat, 
+                      const arma::uvec &S, const arma::uvec &clus_sm){
+  zidm_data data = make_data(z);
+  at_risk_vec gamma;
+  data.compress(gamma_mat.memptr(), gamma);
+  clus_cache cache = make_cache(beta_mat, data);
+  rng_stream rng(rng_key(draw_seed()), 0, step_sm);
+  std::vector<unsigned int> S_vec(S.begin(), S.end());
+  unsigned int clus[2] = {(unsigned int)clus_sm[0], (unsigned int)clus_sm[1]};
+  std::vector<double> marg;
+  sm_marginals(data, gamma, cache, S_vec, clus, 1, marg);
+  realloc_sm(clus_assign, S_vec, clus, marg, rng);
+  return clus_assign;
 }
 
 // [[Rcpp::export]]
-double log_proposal(arma::uvec clus_after, arma::uvec clus_before, 
-                    arma::mat z, arma::mat gamma_mat, arma::mat beta_mat, 
-                    arma::uvec S, arma::uvec clus_sm){
-  
-  /* Calculate the proposal probability, p(after|before), in a log scale */
-  
-  double log_val = 0.0;
-  
-  arma::vec nk(2, arma::fill::zeros);
-  
-  for(int ss = 0; ss < S.size(); ++ss){
-    int s = S[ss];
-    arma::uvec n_index = arma::find(clus_sm == clus_before[s]);
-    nk[n_index[0]] += 1;
-  }
-  
-  
-  for(int ss = 0; ss < S.size(); ++ss){
-    int s = S[ss];
-    arma::uvec old_index = arma::find(clus_sm == clus_before[s]);
-    nk[old_index[0]] -= 1;
-    
-    // Calculate the reallocation probability
-    arma::vec zs = z.row(s).t();
-    arma::vec gms = gamma_mat.row(s).t();
-    arma::vec log_prob(2, arma::fill::zeros);
-    
-    for(int kk = 0; kk <= 1; ++kk){
-      int k = clus_sm[kk];
-      log_prob[kk] += log_marginal(zs, gms, beta_mat.row(k).t());
-      log_prob[kk] += std::log(nk[kk]);
-    }
-    
-    arma::vec prob = log_sum_exp(log_prob);
-    arma::uvec new_index = arma::find(clus_sm == clus_after[s]);
-    log_val += std::log(prob[new_index[0]]);
-    nk[new_index[0]] += 1;
-  }
-  
-  return log_val;
-  
-} 
+double log_proposal(const arma::uvec &clus_after, const arma::uvec &clus_before,
+                    const arma::mat &z, const arma::mat &gamma_mat, 
+                    const arma::mat &beta_mat, const arma::uvec &S, 
+                    const arma::uvec &clus_sm){
+  zidm_data data = make_data(z);
+  at_risk_vec gamma;
+  data.compress(gamma_mat.memptr(), gamma);
+  clus_cache cache = make_cache(beta_mat, data);
+  std::vector<unsigned int> S_vec(S.begin(), S.end());
+  unsigned int clus[2] = {(unsigned int)clus_sm[0], (unsigned int)clus_sm[1]};
+  std::vector<double> marg;
+  sm_marginals(data, gamma, cache, S_vec, clus, 1, marg);
+  return log_proposal(clus_after, clus_before, S_vec, clus, marg);
+}
 
 // *****************************************************************************
 // [[Rcpp::export]]
-arma::mat update_at_risk(arma::mat z, arma::uvec clus_assign, arma::mat gamma_mat, 
-                         arma::mat beta_mat, double r0g, double r1g){
-  
-  /* Update the at-risk matrix. */
-  
-  arma::mat gamma_new(z.n_rows, z.n_cols, arma::fill::value(-1));
-  
-  for(int i = 0; i < z.n_rows; ++i){
-    
-    arma::vec zi = z.row(i).t();
-    arma::vec gm_i = gamma_mat.row(i).t();
-    arma::vec beta_k = beta_mat.row(clus_assign[i]).t(); 
-    
-    arma::uvec zi0 = arma::find(zi == 0);
-    
-    for(int k = 0; k < zi0.size(); ++k){
-      int pp_gmk = 1 - gm_i[zi0[k]];
-      arma::vec proposed_k(gm_i);
-      proposed_k[zi0[k]] = pp_gmk;
-      
-      // Calculate logA
-      double logA = 0.0;
-      logA += R::lbeta(r0g + pp_gmk, r1g + (1 - pp_gmk));
-      logA += log_marginal(zi, proposed_k, beta_k);
-      logA -= R::lbeta(r0g + gm_i[zi0[k]], r1g + (1 - gm_i[zi0[k]]));
-      logA -= log_marginal(zi, gm_i, beta_k);
-      
-      // MH
-      double logU = std::log(R::runif(0.0, 1.0));
-      if(logU <= logA){
-        gm_i = proposed_k;
-      }
+arma::mat update_at_risk(const arma::mat &z, const arma::uvec &clus_assign, 
+                         const arma::mat &gamma_mat, const arma::mat &beta_mat, 
+                         double r0g, double r1g){
+  zidm_data data = make_data(z);
+  at_risk_vec gamma;
+  data.compress(gamma_mat.memptr(), gamma);
+  clus_cache cache = make_cache(beta_mat, data);
+  update_at_risk(data, clus_assign, gamma, cache, r0g, r1g,
+                 rng_key(draw_seed()), 0, 1);
+  arma::mat gamma_out(z.n_rows, z.n_cols);
+  data.expand(gamma, gamma_out.memptr());
+  return gamma_out;
+}
 
-    }
-    
-    gamma_new.row(i) = gm_i.t();
-    
-  }
-  
-  return gamma_new;
-  
+// [[Rcpp::export]]
+arma::mat update_beta(const arma::mat &z, const arma::uvec &clus_assign, 
+                      const arma::mat &gamma_mat, arma::mat beta_mat, 
+                      double mu, double s2, double s2_MH){
+  zidm_data data = make_data(z);
+  at_risk_vec gamma;
+  data.compress(gamma_mat.memptr(), gamma);
+  clus_cache cache = make_cache(beta_mat, data);
+  sampler_work work(z.n_rows, z.n_cols, beta_mat.n_rows);
+  beta_adapt mh(beta_mat.n_rows, z.n_cols, s2_MH);
+  update_beta(data, clus_assign, gamma, beta_mat, cache, mu, s2, mh, false,
+              rng_key(draw_seed()), 0, work);
+  return beta_mat;
 }
 
 // [[Rcpp::export]]
-arma::mat update_beta(arma::mat z, arma::uvec clus_assign, arma::mat gamma_mat, 
-                      arma::mat beta_mat, double mu, double s2, double s2_MH){
-  
-  /* Update the beta matrix. */
-  
-  arma::mat beta_new(beta_mat);
-  arma::uvec active_clus = arma::unique(clus_assign);
-  
-  arma::mat s2_MH_mat(beta_mat.n_cols, beta_mat.n_cols, arma::fill::eye);
-  s2_MH_mat = s2_MH_mat * std::sqrt(s2_MH);
-  
-  for(int kk = 0; kk < active_clus.size(); ++kk){
-    int k = active_clus[kk];
-    double logA = 0.0;
-    
-    // Propose a new beta_k
-    arma::vec proposed_beta = arma::mvnrnd(beta_mat.row(k).t(), s2_MH_mat);
-    
-    // Calculate logA
-    logA += arma::accu(arma::log_normpdf(proposed_beta, mu, std::sqrt(s2)));
-    logA -= arma::accu(arma::log_normpdf(beta_mat.row(k).t(), mu, std::sqrt(s2)));
-    
-    arma::uvec index_k = arma::find(clus_assign == k);
-    
-    for(int ii = 0; ii < index_k.size(); ++ii){
-      int i = index_k[ii];
-      logA += log_marginal(z.row(i).t(), gamma_mat.row(i).t(), proposed_beta);
-      logA -= log_marginal(z.row(i).t(), gamma_mat.row(i).t(), beta_mat.row(k).t());
-    }
-    
-    // MH
-    double logU = std::log(R::runif(0.0, 1.0));
-    if(logU <= logA){
-      beta_new.row(k) = proposed_beta.t();
-    }
-    
-  }
+Rcpp::List realloc(const arma::mat &z, arma::uvec clus_assign,
+                   const arma::mat &gamma_mat, arma::mat beta_mat,
+                   arma::vec tau_vec, const arma::vec &theta_vec){
+  zidm_data data = make_data(z);
+  at_risk_vec gamma;
+  data.compress(gamma_mat.memptr(), gamma);
+  clus_cache cache = make_cache(beta_mat, data);
+  sampler_work work(z.n_rows, z.n_cols, beta_mat.n_rows);
+  realloc(data, clus_assign, gamma, cache, theta_vec, rng_key(draw_seed()), 
+          0, work);
   
-  return beta_new;
+  // Adjust tau and beta
+  adjust_tau_beta(work.nk, tau_vec, beta_mat);
   
+  Rcpp::List result;
+  result["assign"] = clus_assign;
+  result["tau"] = tau_vec;
+  result["beta"] = beta_mat;
+  return result;
 }
 
 // [[Rcpp::export]]
-Rcpp::List realloc(arma::mat z, arma::uvec clus_assign,
-                   arma::mat gamma_mat, arma::mat beta_mat,
-                   arma::vec tau_vec, arma::vec theta_vec){
-  
-  /* Reallocate */
-  
-  arma::uvec new_assign(clus_assign);
-  arma::uvec active_clus = arma::unique(clus_assign);
-  unsigned int K_max = active_clus.size();
-  arma::vec nk(active_clus.size(), arma::fill::zeros);
-  
-  // Count the number of element in each cluster
-  for(int i = 0; i < z.n_rows; ++i){
-    arma::uvec n_index = arma::find(active_clus == new_assign[i]);
-    nk[n_index[0]] += 1;
-  }
-  
-  // Reallocate
-  for(int i = 0; i < z.n_rows; ++i){
-    
-    arma::uvec n_index = arma::find(active_clus == new_assign[i]);
-    nk[n_index[0]] -= 1;
-    
-    arma::vec zi = z.row(i).t();
-    arma::vec gmi = gamma_mat.row(i).t();
-    arma::vec log_prob(K_max, arma::fill::zeros);
-    
-    for(int kk = 0; kk < K_max; ++kk){
-      int k = active_clus[kk];
-      log_prob[kk] += log_marginal(zi, gmi, beta_mat.row(k).t());
-      log_prob[kk] += std::log(theta_vec[k] + nk[kk]);
-    }
-    
-    arma::vec realloc_prob = log_sum_exp(log_prob);
-    Rcpp::NumericVector realloc_rcpp = Rcpp::NumericVector(realloc_prob.begin(), 
-                                                           realloc_prob.end());
-    Rcpp::IntegerVector realloc_rcpp_index = rmultinom_1(realloc_rcpp, K_max);
-    arma::vec realloc_index = Rcpp::as<arma::vec>(Rcpp::wrap(realloc_rcpp_index));
-    
-    // New assign
-    arma::uvec new_ck = arma::find(realloc_index == 1);
-    new_assign.row(i).fill(active_clus[new_ck[0]]);
-    
-    nk[new_ck[0]] += 1;
-    
-  }
+Rcpp::List realloc_blocked(const arma::mat &z, arma::uvec clus_assign,
+                           const arma::mat &gamma_mat, arma::mat beta_mat,
+                           arma::vec tau_vec, unsigned int n_threads = 1){
+  check_threads(n_threads);
+  zidm_data data = make_data(z);
+  at_risk_vec gamma;
+  data.compress(gamma_mat.memptr(), gamma);
+  clus_cache cache = make_cache(beta_mat, data);
+  sampler_work work(z.n_rows, z.n_cols, beta_mat.n_rows);
+  realloc_blocked(data, clus_assign, gamma, cache, tau_vec, 
+                  rng_key(draw_seed()), 0, n_threads, work);
   
   // Adjust tau and beta
-  Rcpp::List new_tb = adjust_tau_beta(beta_mat, tau_vec, new_assign);
-  arma::mat new_beta = new_tb["beta"];
-  arma::vec new_tau = new_tb["tau"];
+  adjust_tau_beta(work.nk, tau_vec, beta_mat);
   
   Rcpp::List result;
-  result["assign"] = new_assign;
-  result["tau"] = new_tau;
-  result["beta"] = new_beta;
+  result["assign"] = clus_assign;
+  result["tau"] = tau_vec;
+  result["beta"] = beta_mat;
   return result;
-  
 }
 
 // [[Rcpp::export]]
-Rcpp::List sm(unsigned int K_max, arma::mat z, arma::uvec clus_assign,
-              arma::mat gamma_mat, arma::mat beta_mat, arma::vec tau_vec, 
-              arma::vec theta_vec, unsigned int launch_iter,
+Rcpp::List sm(unsigned int K_max, const arma::mat &z, arma::uvec clus_assign,
+              const arma::mat &gamma_mat, arma::mat beta_mat, arma::vec tau_vec,
+              const arma::vec &theta_vec, unsigned int launch_iter,
               double mu, double s2, double r0c, double r1c){
-  
-  /* Expand/Collapse the cluster space via Split-Merge */
-  
-  unsigned int n = z.n_rows;
-  arma::uvec active_clus = arma::unique(clus_assign);
-  unsigned int K_pos = active_clus.size();
-  int expand_ind = -1;
-  
-  // Decide to expand (split) or collapse (merge)
-  arma::uvec samp_ind = arma::randperm(n, 2);
-  while((K_pos == K_max) and 
-          (clus_assign[samp_ind[0]] == clus_assign[samp_ind[1]])){
-    samp_ind = arma::randperm(n, 2);
-  }
-  
-  // Create a set S
-  arma::uvec samp_clus = clus_assign.rows(samp_ind);
-  arma::uvec S = arma::find(clus_assign == samp_clus[0] or
-                              clus_assign == samp_clus[1]);
-  arma::uvec notS = arma::find(S != samp_ind[0] and S != samp_ind[1]);
-  S = S.rows(notS);
-  
-  arma::uvec launch_assign(clus_assign);
-  arma::vec launch_tau(tau_vec);
-  arma::mat launch_beta(beta_mat);
-  
-  if(samp_clus[0] == samp_clus[1]){ // Split
-    expand_ind = 1;
-    arma::uvec inactive_clus = arma::find(tau_vec == 0);
-    int new_ck = inactive_clus[arma::randperm(inactive_clus.size(), 1)[0]];
-    launch_assign.row(samp_ind[0]).fill(new_ck);
-    samp_clus.row(0).fill(new_ck);
-    launch_tau.row(new_ck) = R::rgamma(theta_vec[new_ck], 1.0);
-    launch_beta.row(new_ck) = arma::randn(z.n_cols, arma::distr_param(mu, std::sqrt(s2))).t(); 
-  } else { // Merge
-    expand_ind = 0;
-  }
-  
-  // Perform a launch step
-  arma::vec rand_index = arma::randu(S.size());
-  launch_assign.rows(S) = samp_clus.rows((rand_index >= 0.5));
-  for(int t = 0; t <= launch_iter; ++t){
-    launch_assign = realloc_sm(z, launch_assign, gamma_mat, launch_beta, S, samp_clus);
-  }
-  
-  // Perform last SM
-  arma::uvec proposed_assign(launch_assign);
-  if(expand_ind == 1){
-    proposed_assign = realloc_sm(z, launch_assign, gamma_mat, launch_beta, S, samp_clus);
-  } else {
-    proposed_assign.rows(S).fill(samp_clus[1]);
-    proposed_assign.rows(samp_ind).fill(samp_clus[1]);
-  }
-  
-  Rcpp::List proposed_tb =  adjust_tau_beta(launch_beta, launch_tau, proposed_assign);
-  arma::mat proposed_beta = proposed_tb["beta"];
-  arma::vec proposed_tau = proposed_tb["tau"];
-  
-  // MH
-  double logA = 0.0;
-  arma::vec nk_old(K_max, arma::fill::zeros);
-  arma::vec nk_proposed(K_max, arma::fill::zeros);
-  
-  for(int i = 0; i < z.n_rows; ++i){
-    arma::vec zi = z.row(i).t();
-    arma::vec gmi = gamma_mat.row(i).t();
-    logA += log_marginal(zi, gmi, proposed_beta.row(proposed_assign[i]).t());
-    logA -= log_marginal(zi, gmi, beta_mat.row(clus_assign[i]).t());
-    
-    nk_old[clus_assign[i]] += 1;
-    nk_proposed[proposed_assign[i]] += 1;
-    
-  }
-  
-  arma::uvec proposed_active = arma::find(nk_proposed > 0); 
-  logA += std::lgamma(arma::accu(theta_vec.rows(proposed_active)));
-  logA -= arma::accu(arma::lgamma(theta_vec.rows(proposed_active)));
-  logA += arma::accu(arma::lgamma(nk_proposed.rows(proposed_active) + theta_vec.rows(proposed_active)));
-  logA -= std::lgamma(arma::accu(nk_proposed.rows(proposed_active) + theta_vec.rows(proposed_active)));
-  
-  logA -= std::lgamma(arma::accu(theta_vec.rows(active_clus)));
-  logA += arma::accu(arma::lgamma(theta_vec.rows(active_clus)));
-  logA -= arma::accu(arma::lgamma(nk_old.rows(active_clus) + theta_vec.rows(active_clus)));
-  logA += std::lgamma(arma::accu(nk_old.rows(active_clus) + theta_vec.rows(active_clus)));
-  
-  logA += arma::accu(arma::log_normpdf(proposed_beta, mu, std::sqrt(s2)));
-  logA -= arma::accu(arma::log_normpdf(beta_mat, mu, std::sqrt(s2)));
-  
-  logA += log_proposal(launch_assign, proposed_assign, z, gamma_mat, 
-                       launch_beta, S, samp_clus);
-  if(expand_ind == 1){
-    logA -= log_proposal(proposed_assign, launch_assign, z, gamma_mat, 
-                         launch_beta, S, samp_clus);
-  }
-  
-  // MH
-  double logU = std::log(R::runif(0.0, 1.0));
-  int sm_accept = 0;
-  arma::uvec new_assign(clus_assign);
-  arma::vec new_tau(tau_vec);
-  arma::mat new_beta(beta_mat);
-  if(logU <= logA){
-    sm_accept += 1;
-    new_assign = proposed_assign;
-    new_beta = proposed_beta;
-    new_tau = proposed_tau;
-  }
+  zidm_data data = make_data(z);
+  at_risk_vec gamma;
+  data.compress(gamma_mat.memptr(), gamma);
+  clus_cache cache = make_cache(beta_mat, data);
+  sampler_work work(z.n_rows, z.n_cols, K_max);
+  rng_stream rng(rng_key(draw_seed()), 0, step_sm);
+  sm_result sm_out = sm(K_max, data, clus_assign, gamma, beta_mat, cache,
+                        tau_vec, theta_vec, launch_iter, mu, s2, r0c, r1c, rng,
+                        1, work);
   
   Rcpp::List result;
-  result["S"] = S;
-  result["logA"] = logA;
-  result["expand_ind"] = expand_ind;
-  result["sm_accept"] = sm_accept;
-  result["assign"] = new_assign;
-  result["tau"] = new_tau;
-  result["beta"] = new_beta;
+  result["S"] = arma::uvec(std::vector<arma::uword>(work.S.begin(),
+                                                    work.S.end()));
+  result["logA"] = sm_out.logA;
+  result["expand_ind"] = sm_out.expand_ind;
+  result["sm_accept"] = sm_out.sm_accept;
+  result["assign"] = clus_assign;
+  result["tau"] = tau_vec;
+  result["beta"] = beta_mat;
   return result;
-  
 }
 
 // [[Rcpp::export]]
-Rcpp::List update_tau(arma::uvec clus_assign, arma::vec tau_vec, 
-                      arma::vec theta_vec, double U){
-  
-  /* Update tau and U */
-  
-  arma::vec new_tau(tau_vec);
-  arma::uvec active_clus = arma::unique(clus_assign);
-  double scale_U = 1/(1 + U);
-  
-  for(int kk = 0; kk < active_clus.size(); ++kk){
-    int k = active_clus[kk];
-    arma::uvec nk = arma::find(clus_assign == k);
-    new_tau.row(k).fill(R::rgamma(nk.size() + theta_vec[k], scale_U)); 
-  }
+Rcpp::List update_tau(const arma::uvec &clus_assign, arma::vec tau_vec,
+                      const arma::vec &theta_vec, double U){
   
-  double scale_u = 1/arma::accu(new_tau);
-  double new_U = R::rgamma(clus_assign.size(), scale_u);
+  sampler_work work(clus_assign.n_elem, 0, tau_vec.n_elem);
+  update_tau(clus_assign, tau_vec, theta_vec, U, rng_key(draw_seed()), 0,
+             work);
   
   Rcpp::List result;
-  result["tau"] = new_tau;
-  result["U"] = new_U;
+  result["tau"] = tau_vec;
+  result["U"] = U;
   return result;
 }
 
 // *****************************************************************************
-// [[Rcpp::export]]
-arma::mat DM_DM(unsigned int iter, unsigned int K_max, arma::mat z,
-                arma::vec theta_vec, double MH_var, double mu, double s2,
-                int print_iter){
+unsigned int trace_mask(const Rcpp::CharacterVector &traces){
   
-  /* This is one of our competitive model. We have to specify the number of 
-  clusters, and we did not update the at-risk indicator. */
-  
-  arma::mat clus_iter(iter, z.n_rows, arma::fill::value(-1));
-  
-  // Initial the cluster assignment and beta matrix
-  arma::uvec ci_init(z.n_rows, arma::fill::zeros);
-  arma::mat beta_init(K_max, z.n_cols, arma::fill::ones);
-  
-  arma::mat gamma_mat(z.n_rows, z.n_cols, arma::fill::ones);
-  
-  // MCMC object
-  arma::mat beta_mcmc(beta_init);
-  
-  for(int t = 0; t < iter; ++t){
-    
-    // Update beta
-    beta_mcmc = update_beta(z, ci_init, gamma_mat, beta_init, mu, s2, MH_var);
-    
-    // Reallocate
-    arma::uvec ci_mcmc(ci_init);
-    arma::vec nk(K_max, arma::fill::zeros);
-    
-    // Count the number of element in each cluster
-    for(int i = 0; i < z.n_rows; ++i){
-      nk[ci_init[i]] += 1;
-    }
-    
-    for(int i = 0; i < z.n_rows; ++i){
-      
-      nk[ci_init[i]] -= 1;
-      
-      arma::vec zi = z.row(i).t();
-      arma::vec gmi = gamma_mat.row(i).t();
-      arma::vec log_prob(K_max, arma::fill::zeros);
-      
-      for(int k = 0; k < K_max; ++k){
-        log_prob[k] += log_marginal(zi, gmi, beta_mcmc.row(k).t());
-        log_prob[k] += std::log(theta_vec[k] + nk[k]);
-      }
-      
-      arma::vec realloc_prob = log_sum_exp(log_prob);
-      Rcpp::NumericVector realloc_rcpp = Rcpp::NumericVector(realloc_prob.begin(), 
-                                                             realloc_prob.end());
-      Rcpp::IntegerVector realloc_rcpp_index = rmultinom_1(realloc_rcpp, K_max);
-      arma::vec realloc_index = Rcpp::as<arma::vec>(Rcpp::wrap(realloc_rcpp_index));
-      
-      // New assign
-      arma::uvec new_ck = arma::find(realloc_index == 1);
-      ci_mcmc.row(i).fill(new_ck[0]);
-      
-      nk[ci_mcmc[i]] += 1;
-      
-    }
-    
-    for(int i = 0; i < z.n_rows; ++i){
-      clus_iter.row(t).col(i).fill(ci_mcmc[i]);
-    }
-    
-    ci_init = ci_mcmc;
-    beta_init = beta_mcmc;
-    
-    // Print the result
-    if(((t + 1) - (floor((t + 1)/print_iter) * print_iter)) == 0){
-      std::cout << "Iter: " << (t+1) << " - Done!" << std::endl;
+  /* Convert trace names to the bit mask used by trace_select/trace_writer */
+  
+  unsigned int mask = 0;
+  for(int t = 0; t < traces.size(); ++t){
+    std::string name = Rcpp::as<std::string>(traces[t]);
+    int id = trace_from_name(name);
+    if(id < 0){
+      Rcpp::stop("unknown trace \"%s\".", name);
     }
-    
+    mask |= 1u << id;
   }
-  
-  return clus_iter;
+  return mask;
   
 }
 
+trace_select make_select(unsigned int burn_in, unsigned int thin, 
+                         const Rcpp::CharacterVector &traces = 
+                           Rcpp::CharacterVector::create("assign")){
+  if(thin == 0){
+    Rcpp::stop("thin must be a positive integer.");
+  }
+  return trace_select(burn_in, thin, trace_mask(traces));
+}
 
 // [[Rcpp::export]]
-Rcpp::List DM_ZIDM(unsigned int iter, unsigned int K_max, arma::mat z,
-                   arma::vec theta_vec, unsigned int launch_iter,
-                   double MH_var, double mu, double s2, 
-                   double r0c, double r1c, int print_iter){
+arma::mat DM_DM(unsigned int iter, unsigned int K_max, const arma::mat &z,
+                const arma::vec &theta_vec, double MH_var, double mu, double s2,
+                int print_iter, unsigned int burn_in = 0, 
+                unsigned int thin = 1, unsigned int beta_block = 0){
   
-  /* This is one of our competitive model. We include the SM for the cluster
-     space, but we did not update the at-risk indicator. */
+  /* This is one of our competitive model. We have to specify the number of 
+  clusters, and we did not update the at-risk indicator. Only the iterations
+  after burn_in, every thin-th, are recorded. With beta_block > 0, beta_k is
+  updated by blocks of beta_block taxa. */
   
-  // Store the result
-  arma::mat clus_iter(iter, z.n_rows, arma::fill::value(-1));
-  arma::cube beta_iter(K_max, z.n_cols, iter);
-  arma::vec sm_iter(iter, arma::fill::zeros); 
-  arma::vec accept_iter(iter, arma::fill::zeros);
-  arma::vec logA_sm_iter(iter, arma::fill::zeros);
+  zidm_param param = {K_max, theta_vec, 0, MH_var, mu, s2, false, 1.0, 1.0, 
+                      1.0, 1.0, false, 0, sm_fixed, 1, false, beta_block, 
+                      false, false};
+  zidm_options opt;
+  opt.iter = iter;
+  opt.sel = make_select(burn_in, thin);
+  opt.print_iter = print_iter;
   
-  arma::mat gamma_mat(z.n_rows, z.n_cols, arma::fill::ones);
+  zidm_run run = zidm_fit_dm(z, param, opt, rng_key(draw_seed()));
+  return run.trace.assign;
   
-  // Initialize
-  arma::uvec ci_init(z.n_rows, arma::fill::zeros);
-  arma::mat beta_init(K_max, z.n_cols, arma::fill::ones);
-  arma::vec tau_init(K_max, arma::fill::zeros);
-  tau_init.row(0).fill(R::rgamma(theta_vec[0], 1.0));
-  double U_init = R::rgamma(z.n_rows, 1/(arma::accu(tau_init)));
-  
-  // MCMC object
-  arma::mat beta_mcmc(beta_init);
-  Rcpp::List realloc_List;
-  Rcpp::List sm_List;
-  Rcpp::List tau_List;
-  
-  // Begin
-  for(int t = 0; t < iter; ++t){
-    
-    // Update beta
-    beta_mcmc = update_beta(z, ci_init, gamma_mat, beta_init, mu, s2, MH_var);
-    
-    // Reallocate
-    realloc_List = realloc(z, ci_init, gamma_mat, beta_mcmc, tau_init, theta_vec);
-    arma::uvec ci_realloc = realloc_List["assign"];
-    arma::vec tau_realloc = realloc_List["tau"];
-    arma::mat beta_realloc = realloc_List["beta"];
-    
-    // Split-Merge
-    sm_List = sm(K_max, z, ci_realloc, gamma_mat, beta_mcmc, tau_realloc, 
-                 theta_vec, launch_iter, mu, s2, r0c, r1c);
-    
-    logA_sm_iter.row(t).fill(sm_List["logA"]);
-    sm_iter.row(t).fill(sm_List["expand_ind"]);
-    accept_iter.row(t).fill(sm_List["sm_accept"]);
-    arma::uvec ci_sm = sm_List["assign"];
-    arma::vec tau_sm = sm_List["tau"];
-    arma::mat beta_sm = sm_List["beta"];
-    
-    // Update tau and U
-    tau_List = update_tau(ci_sm, tau_sm, theta_vec, U_init);
-    arma::vec tau_U = tau_List["tau"];
-    double U_U = tau_List["U"];
-    
-    // Record the result
-    beta_iter.slice(t) = beta_sm;
-    
-    for(int i = 0; i < z.n_rows; ++i){
-      clus_iter.row(t).col(i).fill(ci_sm[i]);
+}
+
+Rcpp::DataFrame profile_table(const chain_profile &prof){
+
+  /* One row per step (see zidm_profile.h): the calls, the seconds in total,
+     per call and as a share of the run, and the proposals, acceptances and 
+     acceptance rate of the moves (NA for the other steps) */
+
+  const double total = prof.seconds[prof_total];
+  Rcpp::CharacterVector step(n_prof_steps);
+  Rcpp::NumericVector calls(n_prof_steps), seconds(n_prof_steps), 
+    ms_per_call(n_prof_steps), share(n_prof_steps), proposed(n_prof_steps), 
+    accepted(n_prof_steps), accept_rate(n_prof_steps);
+  for(int s = 0; s < n_prof_steps; ++s){
+    step[s] = profile_names[s];
+    calls[s] = prof.calls[s];
+    seconds[s] = prof.seconds[s];
+    ms_per_call[s] = (prof.calls[s] > 0) ? 
+      1000.0 * prof.seconds[s] / prof.calls[s] : NA_REAL;
+    share[s] = (total > 0) ? prof.seconds[s] / total : NA_REAL;
+    bool move = (s == prof_at_risk) or (s == prof_beta) or 
+      (s == prof_split) or (s == prof_merge);
+    proposed[s] = move ? prof.proposed[s] : NA_REAL;
+    accepted[s] = move ? prof.accepted[s] : NA_REAL;
+    accept_rate[s] = (move and (prof.proposed[s] > 0)) ? 
+      prof.accepted[s] / prof.proposed[s] : NA_REAL;
+  }
+  return Rcpp::DataFrame::create(Rcpp::Named("step") = step, 
+                                 Rcpp::Named("calls") = calls, 
+                                 Rcpp::Named("seconds") = seconds, 
+                                 Rcpp::Named("ms_per_call") = ms_per_call, 
+                                 Rcpp::Named("share") = share, 
+                                 Rcpp::Named("proposed") = proposed, 
+                                 Rcpp::Named("accepted") = accepted, 
+                                 Rcpp::Named("accept_rate") = accept_rate,
+                                 Rcpp::Named("stringsAsFactors") = false);
+
+}
+
+Rcpp::NumericVector psm_dist(const psm_accum &psm){
+
+  /* The posterior similarity matrix as an R "dist" object, whose lower 
+     triangle, column after column, is the packed upper triangle of psm. 
+     The values are co-clustering probabilities rather than distances: 
+     as.matrix() gives the matrix with 0 instead of 1 on the diagonal. */
+
+  std::vector<float> prob = psm.probabilities();
+  Rcpp::NumericVector d(prob.size());
+  for(std::size_t e = 0; e < prob.size(); ++e){
+    d[e] = prob[e];
+  }
+  d.attr("Size") = psm.n;
+  d.attr("Diag") = false;
+  d.attr("Upper") = false;
+  d.attr("class") = "dist";
+  return d;
+
+}
+
+Rcpp::List chain_result(const zidm_run &run, const trace_select &sel, 
+                        const std::string &out_file){
+
+  /* The R list returned by DM_ZIDM and ZIDM_ZIDM */
+
+  const chain_trace &trace = run.trace;
+  Rcpp::List result;
+  if(not out_file.empty()){
+    result["file"] = out_file;
+  } else if(sel.has(trace_assign)){
+    result["assign"] = trace.assign;
+  }
+  result["sm"] = trace.sm;
+  result["accept_iter"] = trace.accept;
+  result["sm_attempts"] = trace.attempts;
+  result["beta_accept"] = trace.beta_accept;
+  result["beta_scale"] = trace.beta_scale;
+  result["beta_sd"] = trace.beta_sd;
+  if(trace.profile.on){
+    result["profile"] = profile_table(trace.profile);
+  }
+  if(trace.psm.n > 0){
+    result["psm"] = psm_dist(trace.psm);
+  }
+  if(not run.point.empty()){
+    result["point"] = run.point;
+  }
+  if(out_file.empty()){
+    if(sel.has(trace_gamma)){
+      result["gamma"] = trace.gamma;
+    }
+    if(sel.has(trace_beta)){
+      result["beta"] = trace.beta;
+    }
+    if(sel.has(trace_tau)){
+      result["tau"] = trace.tau;
     }
-    
-    // Update the initial value for the next iteration
-    ci_init = ci_sm;
-    beta_init = beta_sm;
-    tau_init = tau_U;
-    U_init = U_U;
-    
-    // Print the result
-    if(((t + 1) - (floor((t + 1)/print_iter) * print_iter)) == 0){
-      std::cout << "Iter: " << (t+1) << " - Done!" << std::endl;
+    if(sel.has(trace_U)){
+      result["U"] = trace.U;
+    }
+    if(sel.has(trace_logA)){
+      result["logA"] = trace.logA;
     }
-    
   }
-  
-  // Result
-  Rcpp::List result;
-  result["assign"] = clus_iter;
-  result["sm"] = sm_iter;
-  result["accept_iter"] = accept_iter;
   return result;
-  
+
 }
 
 // [[Rcpp::export]]
-Rcpp::List ZIDM_ZIDM(unsigned int iter, unsigned int K_max, arma::mat z,
-                     arma::vec theta_vec, unsigned int launch_iter,
+Rcpp::List DM_ZIDM(unsigned int iter, unsigned int K_max, const arma::mat &z,
+                   const arma::vec &theta_vec, unsigned int launch_iter,
+                   double MH_var, double mu, double s2, 
+                   double r0c, double r1c, int print_iter, 
+                   unsigned int burn_in = 0, unsigned int thin = 1,
+                   Rcpp::CharacterVector out_traces = Rcpp::CharacterVector::create("assign"),
+                   std::string out_file = "", bool compress = true,
+                   std::string realloc_mode = "sequential", 
+                   unsigned int n_threads = 1, unsigned int sm_attempts = 1,
+                   std::string sm_schedule = "fixed", unsigned int sm_every = 1,
+                   bool MH_adapt = false, unsigned int beta_block = 0,
+                   bool profile = false, bool psm = false, 
+                   std::string point_loss = "VI"){
+
+  /* This is one of our competitive model. We include the SM for the cluster
+     space, but we did not update the at-risk indicator. The out_traces are 
+     recorded after burn_in, every thin-th iteration, and returned or, if 
+     out_file is given, streamed to that file (see read_trace). With 
+     realloc_mode = "blocked", the labels are drawn given tau, in parallel 
+     on n_threads threads. sm_attempts and sm_schedule set the number of 
+     split-merge proposals per iteration (see sm_count); the result gives 
+     the number of proposals and accepted proposals of every iteration. With
+     MH_adapt, the scales of the beta proposals are adapted during burn_in 
+     (see beta_adapt); beta_accept gives the acceptance rate of every 
+     cluster after burn_in. With beta_block > 0, beta_k is updated by blocks
+     of beta_block taxa (see update_beta_blocked). With profile, the result 
+     has the time and acceptances of every step (see profile_table). With 
+     psm, the result has the posterior similarity matrix of the kept 
+     iterations (see psm_dist) and, unless point_loss is "none", the point 
+     estimate of the labels that minimizes the "binder" or "VI" loss (see 
+     zidm_psm.h); out_traces = character(0) then skips the assign trace. */
+
+  zidm_param param = {K_max, theta_vec, launch_iter, MH_var, mu, s2, 
+                      false, 1.0, 1.0, r0c, r1c, 
+                      blocked_realloc(realloc_mode), sm_attempts, 
+                      sm_plan_type(sm_schedule, sm_attempts, sm_every), 
+                      sm_every, MH_adapt, beta_block, profile, psm};
+  zidm_options opt;
+  opt.iter = iter;
+  opt.sel = make_select(burn_in, thin, out_traces);
+  opt.n_threads = n_threads;
+  opt.print_iter = print_iter;
+  opt.out_file = out_file;
+  opt.compress = compress;
+  opt.point_loss = point_loss_type(point_loss);
+
+  zidm_run run = zidm_fit(z, param, opt, rng_key(draw_seed()));
+  return chain_result(run, opt.sel, out_file);
+
+}
+
+// [[Rcpp::export]]
+Rcpp::List ZIDM_ZIDM(unsigned int iter, unsigned int K_max, const arma::mat &z,
+                     const arma::vec &theta_vec, unsigned int launch_iter,
                      double MH_var, double mu, double s2, double r0g, double r1g, 
-                     double r0c, double r1c, int print_iter){
-  
+                     double r0c, double r1c, int print_iter, 
+                     unsigned int burn_in = 0, unsigned int thin = 1,
+                     Rcpp::CharacterVector out_traces = Rcpp::CharacterVector::create("assign"),
+                     std::string out_file = "", bool compress = true,
+                     std::string realloc_mode = "sequential",
+                     unsigned int n_threads = 1, unsigned int sm_attempts = 1, 
+                     std::string sm_schedule = "fixed", 
+                     unsigned int sm_every = 1, bool MH_adapt = false,
+                     unsigned int beta_block = 0, bool profile = false,
+                     bool psm = false, std::string point_loss = "VI",
+                     std::string checkpoint_file = "", 
+                     unsigned int checkpoint_every = 0){
+
   /* This is our model. Update at-risk indicator and include the SM for 
-     the cluster space. */
-  
-  // Store the result
-  arma::mat clus_iter(iter, z.n_rows, arma::fill::value(-1));
-  arma::cube gamma_iter(z.n_rows, z.n_cols, iter);
-  arma::cube beta_iter(K_max, z.n_cols, iter);
-  arma::vec sm_iter(iter, arma::fill::zeros); 
-  arma::vec accept_iter(iter, arma::fill::zeros);
-  arma::vec logA_sm_iter(iter, arma::fill::zeros);
-  
-  // Initialize
-  arma::uvec ci_init(z.n_rows, arma::fill::zeros);
-  arma::mat gamma_init(z.n_rows, z.n_cols, arma::fill::ones);
-  arma::mat beta_init(K_max, z.n_cols, arma::fill::ones);
-  arma::vec tau_init(K_max, arma::fill::zeros);
-  tau_init.row(0).fill(R::rgamma(theta_vec[0], 1.0));
-  double U_init = R::rgamma(z.n_rows, 1/(arma::accu(tau_init)));
-  
-  // MCMC object
-  arma::mat gamma_mcmc(gamma_init);
-  arma::mat beta_mcmc(beta_init);
-  Rcpp::List realloc_List;
-  Rcpp::List sm_List;
-  Rcpp::List tau_List;
-  
-  // Begin
-  for(int t = 0; t < iter; ++t){
-    
-    // Update at-risk
-    gamma_mcmc = update_at_risk(z, ci_init, gamma_init, beta_init, r0g, r1g);
-    
-    // Update beta
-    beta_mcmc = update_beta(z, ci_init, gamma_mcmc, beta_init, mu, s2, MH_var);
-    
-    // Reallocate
-    realloc_List = realloc(z, ci_init, gamma_mcmc, beta_mcmc, tau_init, theta_vec);
-    arma::uvec ci_realloc = realloc_List["assign"];
-    arma::vec tau_realloc = realloc_List["tau"];
-    arma::mat beta_realloc = realloc_List["beta"];
-    
-    // Split-Merge
-    sm_List = sm(K_max, z, ci_realloc, gamma_mcmc, beta_mcmc, tau_realloc, 
-                 theta_vec, launch_iter, mu, s2, r0c, r1c);
-    
-    logA_sm_iter.row(t).fill(sm_List["logA"]);
-    sm_iter.row(t).fill(sm_List["expand_ind"]);
-    accept_iter.row(t).fill(sm_List["sm_accept"]);
-    arma::uvec ci_sm = sm_List["assign"];
-    arma::vec tau_sm = sm_List["tau"];
-    arma::mat beta_sm = sm_List["beta"];
-    
-    // Update tau and U
-    tau_List = update_tau(ci_sm, tau_sm, theta_vec, U_init);
-    arma::vec tau_U = tau_List["tau"];
-    double U_U = tau_List["U"];
-    
-    // Record the result
-    gamma_iter.slice(t) = gamma_mcmc;
-    beta_iter.slice(t) = beta_sm;
-    
-    for(int i = 0; i < z.n_rows; ++i){
-      clus_iter.row(t).col(i).fill(ci_sm[i]);
+     the cluster space. The at-risk update runs on n_threads threads. The 
+     out_traces are recorded after burn_in, every thin-th iteration, and 
+     returned or, if out_file is given, streamed to that file (see 
+     read_trace) instead of being kept in memory. If checkpoint_file is 
+     given, the sampler state is saved there every checkpoint_every 
+     iterations and at the end (see ZIDM_ZIDM_resume). With realloc_mode = 
+     "blocked", the labels are drawn given tau, in parallel as well. 
+     sm_attempts and sm_schedule set the number of split-merge proposals per
+     iteration (see sm_count). With MH_adapt, the beta proposals are adapted
+     during burn_in (see beta_adapt), and with beta_block > 0, beta_k is 
+     updated by blocks of beta_block taxa (see update_beta_blocked). With 
+     profile, the result has the time and acceptances of every step (see 
+     profile_table), and psm and point_loss are as in DM_ZIDM. */
+
+  zidm_param param = {K_max, theta_vec, launch_iter, MH_var, mu, s2, 
+                      true, r0g, r1g, r0c, r1c, blocked_realloc(realloc_mode), 
+                      sm_attempts, 
+                      sm_plan_type(sm_schedule, sm_attempts, sm_every), 
+                      sm_every, MH_adapt, beta_block, profile, psm};
+  zidm_options opt;
+  opt.iter = iter;
+  opt.sel = make_select(burn_in, thin, out_traces);
+  opt.n_threads = n_threads;
+  opt.print_iter = print_iter;
+  opt.out_file = out_file;
+  opt.compress = compress;
+  opt.point_loss = point_loss_type(point_loss);
+  opt.checkpoint_file = checkpoint_file;
+  opt.checkpoint_every = checkpoint_every;
+
+  zidm_run run = zidm_fit(z, param, opt, rng_key(draw_seed()));
+  return chain_result(run, opt.sel, out_file);
+
+}
+
+// [[Rcpp::export]]
+Rcpp::List ZIDM_ZIDM_resume(std::string checkpoint_file, unsigned int iter, 
+                            const arma::mat &z, const arma::vec &theta_vec, 
+                            unsigned int launch_iter, double MH_var, double mu, 
+                            double s2, double r0g, double r1g, double r0c, 
+                            double r1c, int print_iter, 
+                            unsigned int burn_in = 0, unsigned int thin = 1,
+                            Rcpp::CharacterVector out_traces = Rcpp::CharacterVector::create("assign"),
+                            std::string out_file = "", bool compress = true,
+                            std::string realloc_mode = "sequential",
+                            unsigned int n_threads = 1, 
+                            unsigned int sm_attempts = 1, 
+                            std::string sm_schedule = "fixed", 
+                            unsigned int sm_every = 1, bool MH_adapt = false,
+                            unsigned int beta_block = 0, bool profile = false,
+                            bool psm = false, std::string point_loss = "VI",
+                            unsigned int checkpoint_every = 0){
+
+  /* Continue a ZIDM_ZIDM chain from checkpoint_file for iter more 
+     iterations. With the same data and hyperparameters, the draws are the 
+     same as if the original run had not stopped. This also extends a 
+     finished chain. burn_in and thin count from the first iteration of the 
+     chain, as in the original run, so the kept iterations and the 
+     adaptation of the beta proposals (MH_adapt) are those of an 
+     uninterrupted run; the returned traces cover the new iterations. With 
+     the out_file of the original run, the trace file is cut back to the 
+     checkpoint and continued; an existing file that the checkpoint does 
+     not continue is an error. The checkpoint file is updated as in 
+     ZIDM_ZIDM. The draws only continue exactly with the realloc_mode and 
+     split-merge schedule of the original run. With psm, the posterior 
+     similarity matrix is that of the new iterations. */
+
+  unsigned int K_max = theta_vec.n_elem;
+  zidm_param param = {K_max, theta_vec, launch_iter, MH_var, mu, s2, 
+                      true, r0g, r1g, r0c, r1c, blocked_realloc(realloc_mode), 
+                      sm_attempts, 
+                      sm_plan_type(sm_schedule, sm_attempts, sm_every), 
+                      sm_every, MH_adapt, beta_block, profile, psm};
+  zidm_options opt;
+  opt.iter = iter;
+  opt.sel = make_select(burn_in, thin, out_traces);
+  opt.n_threads = n_threads;
+  opt.print_iter = print_iter;
+  opt.out_file = out_file;
+  opt.compress = compress;
+  opt.point_loss = point_loss_type(point_loss);
+  opt.checkpoint_file = checkpoint_file;
+  opt.checkpoint_every = checkpoint_every;
+
+  zidm_run run = zidm_resume(checkpoint_file, z, param, opt);
+  Rcpp::List result = chain_result(run, opt.sel, out_file);
+  result["iter"] = run.state.iter;
+  return result;
+
+}
+
+// [[Rcpp::export]]
+Rcpp::List multi_chain(unsigned int n_chains, std::string model,
+                       unsigned int iter, unsigned int K_max, const arma::mat &z,
+                       const arma::vec &theta_vec, unsigned int launch_iter,
+                       double MH_var, double mu, double s2, double r0g, 
+                       double r1g, double r0c, double r1c, 
+                       unsigned int burn_in = 0, unsigned int thin = 1, 
+                       std::string realloc_mode = "sequential",
+                       unsigned int n_threads = 1, 
+                       unsigned int sm_attempts = 1, 
+                       std::string sm_schedule = "fixed", 
+                       unsigned int sm_every = 1, bool MH_adapt = false,
+                       unsigned int beta_block = 0, bool profile = false,
+                       bool psm = false, std::string point_loss = "VI"){
+
+  /* Run n_chains independent chains of "ZIDM_ZIDM" or "DM_ZIDM", one chain
+     per thread. Chain m uses the streams keyed by (seed, m), so the result
+     does not depend on n_threads. The traces are stacked chain after chain,
+     and the split-Rhat and the effective sample size are computed for the 
+     number of active clusters and the log-likelihood over the kept 
+     iterations. With profile, the profiles of the chains are summed, and 
+     with psm, the posterior similarity matrix and the point estimate (see 
+     DM_ZIDM) are those of all the chains together. */
+
+  if((model != "ZIDM_ZIDM") and (model != "DM_ZIDM")){
+    Rcpp::stop("model must be either \"ZIDM_ZIDM\" or \"DM_ZIDM\".");
+  }
+  check_threads(n_threads);
+  if(theta_vec.n_elem < K_max){
+    Rcpp::stop("theta_vec must have at least K_max elements.");
+  }
+
+  zidm_param param = {K_max, theta_vec, launch_iter, MH_var, mu, s2, 
+                      (model == "ZIDM_ZIDM"), r0g, r1g, r0c, r1c, 
+                      blocked_realloc(realloc_mode), sm_attempts, 
+                      sm_plan_type(sm_schedule, sm_attempts, sm_every), 
+                      sm_every, MH_adapt, beta_block, profile, psm};
+  trace_select sel = make_select(burn_in, thin);
+  std::uint64_t seed = draw_seed();
+  zidm_data data = make_data(z);
+
+  int loss = point_loss_type(point_loss);
+
+  std::vector<chain_trace> traces(n_chains);
+  std::vector<chain_state> states(n_chains);
+
+  // An exception must not leave the parallel region, so the error of every
+  // chain is kept and the first one is thrown after it
+  std::vector<std::exception_ptr> errors(n_chains);
+
+  #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 1)
+  for(int m = 0; m < (int)n_chains; ++m){
+    try {
+      rng_key key(seed, m);
+      init_state(states[m], data, param, key);
+      run_chain(traces[m], states[m], iter, data, param, sel, key, 1, 0, 
+                true, NULL);
+    } catch(...) {
+      errors[m] = std::current_exception();
     }
-    
-    // Update the initial value for the next iteration
-    ci_init = ci_sm;
-    gamma_init = gamma_mcmc;
-    beta_init = beta_sm;
-    tau_init = tau_U;
-    U_init = U_U;
-    
-    // Print the result
-    if(((t + 1) - (floor((t + 1)/print_iter) * print_iter)) == 0){
-      std::cout << "Iter: " << (t+1) << " - Done!" << std::endl;
+  }
+  for(unsigned int m = 0; m < n_chains; ++m){
+    if(errors[m]){
+      std::rethrow_exception(errors[m]);
     }
-    
   }
-  
+
+  // Stack the chains
+  const unsigned int n_keep = sel.n_keep(iter);
+  arma::mat assign(n_chains * n_keep, z.n_rows);
+  arma::vec chain(n_chains * n_keep);
+  arma::vec sm_iter(n_chains * n_keep);
+  arma::vec accept_iter(n_chains * n_keep);
+  arma::vec sm_attempts_iter(n_chains * n_keep);
+  arma::mat K_active(n_keep, n_chains);
+  arma::mat loglik(n_keep, n_chains);
+  arma::mat beta_accept(K_max, n_chains);
+  chain_profile prof(profile);
+  psm_accum pooled;
+  if(psm and (n_chains > 0)){
+    pooled = traces[0].psm;
+  }
+
+  for(unsigned int m = 0; m < n_chains; ++m){
+    beta_accept.col(m) = traces[m].beta_accept;
+    if(profile){
+      prof.merge(traces[m].profile);
+    }
+    if(psm and (m > 0)){
+      pooled.merge(traces[m].psm);
+    }
+  }
+
+  for(unsigned int m = 0; m < n_chains; ++m){
+    if(n_keep == 0){
+      break;
+    }
+    arma::span rows(m * n_keep, (m + 1) * n_keep - 1);
+    assign.rows(rows) = traces[m].assign;
+    chain.rows(rows).fill(m + 1);
+    sm_iter.rows(rows) = traces[m].sm;
+    accept_iter.rows(rows) = traces[m].accept;
+    sm_attempts_iter.rows(rows) = traces[m].attempts;
+    K_active.col(m) = traces[m].K_active;
+    loglik.col(m) = traces[m].loglik;
+  }
+
+  // Convergence diagnostics
+  Rcpp::NumericVector rhat = Rcpp::NumericVector::create(
+    Rcpp::Named("K_active") = split_rhat(K_active.memptr(), n_keep, n_chains),
+    Rcpp::Named("loglik") = split_rhat(loglik.memptr(), n_keep, n_chains));
+  Rcpp::NumericVector n_eff = Rcpp::NumericVector::create(
+    Rcpp::Named("K_active") = ess(K_active.memptr(), n_keep, n_chains),
+    Rcpp::Named("loglik") = ess(loglik.memptr(), n_keep, n_chains));
+
   // Result
   Rcpp::List result;
-  // result["gamma"] = gamma_iter;
-  // result["beta"] = beta_iter;
-  result["assign"] = clus_iter;
+  result["assign"] = assign;
+  result["chain"] = chain;
   result["sm"] = sm_iter;
-  // result["logA"] = logA_sm_iter;
   result["accept_iter"] = accept_iter;
+  result["sm_attempts"] = sm_attempts_iter;
+  result["beta_accept"] = beta_accept;
+  result["K_active"] = K_active;
+  result["loglik"] = loglik;
+  result["rhat"] = rhat;
+  result["ess"] = n_eff;
+  if(profile){
+    result["profile"] = profile_table(prof);
+  }
+  if(psm and (n_chains > 0)){
+    result["psm"] = psm_dist(pooled);
+    if((loss != loss_none) and (pooled.n_draws > 0)){
+      result["point"] = psm_point(pooled, loss, K_max, states[0].assign);
+    }
+  }
   return result;
-  
+
 }
 
+// [[Rcpp::export]]
+SEXP read_trace(std::string file, std::string trace){
+
+  /* Read one trace from a file written by the samplers. The file is memory 
+     mapped, so only the requested trace is decoded. The labels and tau are
+     returned as iteration x n (or K) matrices, gamma and beta as cubes with 
+     one slice per iteration, and the scalar traces as vectors. */
+
+  int id = trace_from_name(trace);
+  if(id < 0){
+    Rcpp::stop("unknown trace \"%s\".", trace);
+  }
+
+  trace_reader reader(file);
+  if(not reader.has(id)){
+    Rcpp::stop("%s does not contain the trace \"%s\".", file, trace);
+  }
+
+  const trace_dims &dims = reader.dimensions();
+  unsigned int n_rec = reader.records(id);
+
+  if(id == trace_assign or id == trace_tau){
+    arma::mat x(dims.values(id), n_rec);
+    reader.read(id, x.memptr());
+    return Rcpp::wrap(arma::mat(x.t()));
+  } else if(id == trace_gamma){
+    arma::cube x(dims.n, dims.p, n_rec);
+    reader.read(id, x.memptr());
+    return Rcpp::wrap(x);
+  } else if(id == trace_beta){
+    arma::cube x(dims.K, dims.p, n_rec);
+    reader.read(id, x.memptr());
+    return Rcpp::wrap(x);
+  }
+
+  arma::vec x(n_rec);
+  reader.read(id, x.memptr());
+  return Rcpp::wrap(x);
+
+}
 
 // *****************************************************************************
 // [[Rcpp::export]]
-arma::cube beta_mat_update(unsigned int K, unsigned int iter, arma::mat z, 
-                           arma::uvec clus_assign, double mu, double s2, 
-                           double s2_MH){
-  
-  /* Try: only beta */
-  
-  arma::cube result(K, z.n_cols, iter);
-  arma::mat gm(z.n_rows, z.n_cols, arma::fill::ones);
-  
+arma::cube beta_mat_update(unsigned int K, unsigned int iter, 
+                           const arma::mat &z, const arma::uvec &clus_assign, 
+                           double mu, double s2, 
+                           double s2_MH, unsigned int burn_in = 0, 
+                           unsigned int thin = 1, unsigned int beta_block = 0){
+
+  /* Try: only beta. With beta_block > 0, by blocks of beta_block taxa */
+
+  trace_select sel = make_select(burn_in, thin);
+  arma::cube result(K, z.n_cols, sel.n_keep(iter));
+  zidm_data data = make_data(z);
+  at_risk_vec gm(data.n_zero(), 1);
+
   // Initialize the beta matrix
-  arma::mat b_init(K, z.n_cols, arma::fill::ones);
-  arma::mat b_mcmc(b_init);
-  
-  for(int t = 0; t < iter; ++t){
-    b_mcmc = update_beta(z, clus_assign, gm, b_init, mu, s2, s2_MH);
-    result.slice(t) = b_mcmc;
-    b_init = b_mcmc;
+  arma::mat b_mcmc(K, z.n_cols, arma::fill::ones);
+  clus_cache cache = make_cache(b_mcmc, data);
+  sampler_work work(z.n_rows, z.n_cols, K);
+  beta_adapt mh(K, z.n_cols, s2_MH);
+  beta_blocks blk(data, K, beta_block > 0 ? beta_block : data.p);
+  rng_key key(draw_seed());
+
+  for(unsigned int t = 0; t < iter; ++t){
+    if(beta_block > 0){
+      update_beta_blocked(data, clus_assign, gm, b_mcmc, cache, mu, s2, mh, 
+                          false, key, t, work, blk);
+    } else {
+      update_beta(data, clus_assign, gm, b_mcmc, cache, mu, s2, mh, false, key,
+                  t, work);
+    }
+    if(sel.keep(t)){
+      result.slice((t - burn_in) / thin) = b_mcmc;
+    }
   }
-  
+
   return result;
-  
+
 }
 
 // [[Rcpp::export]]
-Rcpp::List beta_ar_update(unsigned int K, unsigned int iter, arma::mat z, 
-                          arma::uvec clus_assign, double r0g, double r1g, 
-                          double mu, double s2, double s2_MH){
-  
+Rcpp::List beta_ar_update(unsigned int K, unsigned int iter, 
+                          const arma::mat &z, const arma::uvec &clus_assign, 
+                          double r0g, double r1g, 
+                          double mu, double s2, double s2_MH, 
+                          unsigned int burn_in = 0, unsigned int thin = 1,
+                          Rcpp::CharacterVector out_traces = Rcpp::CharacterVector::create("gamma", "beta"),
+                          unsigned int n_threads = 1){
+
   /* Try: both beta and at-risk */
-  
-  arma::cube at_risk_mat(z.n_rows, z.n_cols, iter);
-  arma::cube beta_mat(K, z.n_cols, iter);
-  
+
+  check_threads(n_threads);
+  trace_select sel = make_select(burn_in, thin, out_traces);
+  arma::cube at_risk_mat;
+  arma::cube beta_mat;
+  if(sel.has(trace_gamma)){
+    at_risk_mat.set_size(z.n_rows, z.n_cols, sel.n_keep(iter));
+  }
+  if(sel.has(trace_beta)){
+    beta_mat.set_size(K, z.n_cols, sel.n_keep(iter));
+  }
+
   // Initialize
-  arma::mat gm_init(z.n_rows, z.n_cols, arma::fill::ones);
-  arma::mat gm_mcmc(gm_init);
-  arma::mat b_init(K, z.n_cols, arma::fill::ones);
-  arma::mat b_mcmc(b_init);
-  
-  for(int t = 0; t < iter; ++t){
-    gm_mcmc = update_at_risk(z, clus_assign, gm_init, b_init, r0g, r1g);
-    b_mcmc = update_beta(z, clus_assign, gm_mcmc, b_init, mu, s2, s2_MH);
-    
-    at_risk_mat.slice(t) = gm_mcmc;
-    beta_mat.slice(t) = b_mcmc;
-    
-    gm_init = gm_mcmc;
-    b_init = b_mcmc;
+  zidm_data data = make_data(z);
+  at_risk_vec gm_mcmc(data.n_zero(), 1);
+  arma::mat b_mcmc(K, z.n_cols, arma::fill::ones);
+  clus_cache cache = make_cache(b_mcmc, data);
+  sampler_work work(z.n_rows, z.n_cols, K);
+  beta_adapt mh(K, z.n_cols, s2_MH);
+  rng_key key(draw_seed());
+
+  for(unsigned int t = 0; t < iter; ++t){
+    update_at_risk(data, clus_assign, gm_mcmc, cache, r0g, r1g, key, t, 
+                   n_threads);
+    update_beta(data, clus_assign, gm_mcmc, b_mcmc, cache, mu, s2, mh, false, 
+                key, t, work);
+  
+    if(sel.keep(t)){
+      unsigned int r = (t - burn_in) / thin;
+      if(sel.has(trace_gamma)){
+        data.expand(gm_mcmc, at_risk_mat.slice_memptr(r));
+      }
+      if(sel.has(trace_beta)){
+        beta_mat.slice(r) = b_mcmc;
+      }
+    }
   }
-  
+
   Rcpp::List result;
-  result["gamma"] = at_risk_mat;
-  result["beta"] = beta_mat;
+  if(sel.has(trace_gamma)){
+    result["gamma"] = at_risk_mat;
+  }
+  if(sel.has(trace_beta)){
+    result["beta"] = beta_mat;
+  }
   return result;
-  
+
 }
 
 // *****************************************************************************
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef CLUSTERZI_ZIDM_CHECK_H
+#define CLUSTERZI_ZIDM_CHECK_H
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+/* Checks of the tests in this directory, without a test framework.
+ * CHECK(cond) reports a failed condition with its line and the test goes
+ * on; main() returns check_status(), which ctest reads as the result. The
+ * files of a test are written to the working directory of ctest.
+ */
+
+static int n_failed = 0;
+
+#define CHECK(cond)                                                       \
+  do {                                                                    \
+    if(not (cond)){                                                       \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond        \
+                << ") failed" << std::endl;                               \
+      n_failed += 1;                                                      \
+    }                                                                     \
+  } while(0)
+
+#define CHECK_THROWS(expr)                                                \
+  do {                                                                    \
+    bool thrown = false;                                                  \
+    try {                                                                 \
+      expr;                                                               \
+    } catch(const std::exception &) {                                     \
+      thrown = true;                                                      \
+    }                                                                     \
+    if(not thrown){                                                       \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " #expr              \
+                << " did not throw" << std::endl;                         \
+      n_failed += 1;                                                      \
+    }                                                                     \
+  } while(0)
+
+inline bool near(double x, double y, double tol = 1e-9){
+  return std::fabs(x - y) <= tol * (1.0 + std::fabs(y));
+}
+
+inline int check_status(const char *name){
+  if(n_failed > 0){
+    std::cerr << name << ": " << n_failed << " failed checks" << std::endl;
+    return 1;
+  }
+  std::cout << name << ": ok" << std::endl;
+  return 0;
+}
+
+#endif
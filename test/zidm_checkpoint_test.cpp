@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "ClusterZI/zidm_api.h"
+#include "zidm_check.h"
+#include "zidm_simulate.h"
+
+/* Checkpoints (see zidm_checkpoint.h and zidm_resume): the file reads back
+ * what was saved and refuses corrupted files, and a chain stopped at a
+ * checkpoint and resumed gives the same state and the same trace file as
+ * the same chain run without a stop, also when the stop came after the
+ * checkpoint and the trace went on past it.
+ */
+
+template <typename A, typename B>
+bool same(const A &a, const B &b){
+  return a.size() == b.size() and std::equal(a.begin(), a.end(), b.begin());
+}
+
+void copy_file(const std::string &from, const std::string &to){
+  std::ifstream in(from.c_str(), std::ios::binary);
+  std::ofstream out(to.c_str(), std::ios::binary);
+  out << in.rdbuf();
+}
+
+void test_file(){
+
+  checkpoint a;
+  a.n = 3;
+  a.p = 2;
+  a.K = 2;
+  a.at_risk = false;
+  a.seed = 42;
+  a.chain = 7;
+  a.iter = 123;
+  a.assign = {0, 1, 1};
+  a.gamma = {1, 0, 1, 1, 1, 0};
+  a.beta = {0.5, -1.25, 2.0, 3.5};
+  a.tau = {0.75, 0.25};
+  a.U = 9.5;
+  a.log_scale = {0.1, -0.2};
+  a.sd = {1.5, 0.5};
+  a.n_adapt = {10, 12};
+  a.n_mom = {8, 9};
+  a.mean = {0.1, 0.2, 0.3, 0.4};
+  a.m2 = {1.0, 2.0, 3.0, 4.0};
+  a.tried = {20, 30};
+  a.accepted = {5, 6};
+  a.sm_tried = 17;
+  a.sm_accepted = 4;
+  a.trace_bytes = 4096;
+  a.trace_records = 55;
+  a.save("ckpt_file.ckpt");
+
+  checkpoint b;
+  b.load("ckpt_file.ckpt");
+  CHECK(b.n == a.n and b.p == a.p and b.K == a.K);
+  CHECK(b.at_risk == a.at_risk);
+  CHECK(b.seed == a.seed and b.chain == a.chain and b.iter == a.iter);
+  CHECK(same(b.assign, a.assign));
+  CHECK(same(b.gamma, a.gamma));
+  CHECK(same(b.beta, a.beta));
+  CHECK(same(b.tau, a.tau));
+  CHECK(b.U == a.U);
+  CHECK(same(b.log_scale, a.log_scale));
+  CHECK(same(b.sd, a.sd));
+  CHECK(same(b.n_adapt, a.n_adapt));
+  CHECK(same(b.n_mom, a.n_mom));
+  CHECK(same(b.mean, a.mean));
+  CHECK(same(b.m2, a.m2));
+  CHECK(same(b.tried, a.tried));
+  CHECK(same(b.accepted, a.accepted));
+  CHECK(b.sm_tried == a.sm_tried and b.sm_accepted == a.sm_accepted);
+  CHECK(b.trace_bytes == a.trace_bytes);
+  CHECK(b.trace_records == a.trace_records);
+
+  // A changed byte of the payload, a cut file and a wrong magic
+  std::ifstream in("ckpt_file.ckpt", std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+  in.close();
+  std::vector<char> bad = bytes;
+  bad[sizeof(checkpoint_header) + 5] ^= 1;
+  std::ofstream("ckpt_bad.ckpt", std::ios::binary).write(&bad[0],
+                                                         bad.size());
+  CHECK_THROWS(b.load("ckpt_bad.ckpt"));
+  std::ofstream("ckpt_bad.ckpt", std::ios::binary).write(&bytes[0],
+                                                         bytes.size() - 1);
+  CHECK_THROWS(b.load("ckpt_bad.ckpt"));
+  bad = bytes;
+  bad[0] = 'X';
+  std::ofstream("ckpt_bad.ckpt", std::ios::binary).write(&bad[0],
+                                                         bad.size());
+  CHECK_THROWS(b.load("ckpt_bad.ckpt"));
+  CHECK_THROWS(b.load("ckpt_missing.ckpt"));
+
+}
+
+void check_same_trace(const std::string &path_a, const std::string &path_b){
+
+  /* Both trace files hold the same records */
+
+  trace_reader a(path_a), b(path_b);
+  CHECK(a.mask() == b.mask());
+  for(int id = 0; id < n_trace; ++id){
+    if(not a.has(id)){
+      continue;
+    }
+    CHECK(a.records(id) == b.records(id));
+    std::size_t size = a.records(id) * a.dimensions().values(id);
+    if(a.records(id) != b.records(id) or size == 0){
+      continue;
+    }
+    std::vector<double> x(size), y(size);
+    a.read(id, &x[0]);
+    b.read(id, &y[0]);
+    CHECK(x == y);
+  }
+
+}
+
+void test_resume(){
+
+  zidm_sim sim = simulate_zidm(40, 15, 3, 0.4, 2000, 11);
+  arma::mat z(&sim.z[0], sim.n, sim.p);
+  const unsigned int K_max = 6;
+  arma::vec theta_vec(K_max);
+  theta_vec.fill(1.0);
+  // Adaptive beta proposals and split-merge schedule, whose state has to
+  // be carried over, and a burn-in that ends after the checkpoint
+  zidm_param param = {K_max, theta_vec, 3, 1.0, 0.0, 1.0, true, 1.0, 1.0,
+                      1.0, 1.0, false, 4, sm_adaptive, 1, true, 0, false,
+                      false};
+  const std::uint32_t mask = (1u << trace_assign) | (1u << trace_gamma) |
+    (1u << trace_beta) | (1u << trace_tau) | (1u << trace_U) |
+    (1u << trace_sm) | (1u << trace_accept);
+  zidm_options opt;
+  opt.sel = trace_select(36, 2, mask);
+  rng_key key(5, 1);
+
+  // Uninterrupted
+  opt.iter = 60;
+  opt.out_file = "resume_full.trc";
+  zidm_run full = zidm_fit(z, param, opt, key);
+
+  // Checkpoint at 30, copied as if the chain had been stopped there after
+  // running on to 40, then resumed from it to 60
+  opt.iter = 30;
+  opt.out_file = "resume_part.trc";
+  opt.checkpoint_file = "resume_part.ckpt";
+  opt.checkpoint_every = 30;
+  zidm_fit(z, param, opt, key);
+  copy_file("resume_part.ckpt", "resume_30.ckpt");
+  opt.iter = 10;
+  zidm_resume("resume_part.ckpt", z, param, opt);
+  copy_file("resume_30.ckpt", "resume_part.ckpt");
+  opt.iter = 30;
+  zidm_run part = zidm_resume("resume_part.ckpt", z, param, opt);
+
+  CHECK(part.state.iter == 60 and full.state.iter == 60);
+  CHECK(same(part.state.assign, full.state.assign));
+  CHECK(same(part.state.gamma, full.state.gamma));
+  CHECK(same(part.state.beta, full.state.beta));
+  CHECK(same(part.state.tau, full.state.tau));
+  CHECK(part.state.U == full.state.U);
+  CHECK(part.state.sm_tried == full.state.sm_tried);
+  CHECK(part.state.sm_accepted == full.state.sm_accepted);
+  CHECK(same(part.state.mh.log_scale, full.state.mh.log_scale));
+  CHECK(same(part.state.mh.sd, full.state.mh.sd));
+  CHECK(same(part.state.mh.accepted, full.state.mh.accepted));
+  check_same_trace("resume_part.trc", "resume_full.trc");
+
+  // The checkpoint of the finished chain is at 60, and it only resumes on
+  // counts of its dimension
+  checkpoint last;
+  last.load("resume_part.ckpt");
+  CHECK(last.iter == 60);
+  opt.out_file = "resume_other.trc";
+  arma::mat z_other(&sim.z[0], sim.n, sim.p - 1);
+  CHECK_THROWS(zidm_resume("resume_part.ckpt", z_other, param, opt));
+
+}
+
+int main(){
+  test_file();
+  test_resume();
+  return check_status("zidm_checkpoint_test");
+}
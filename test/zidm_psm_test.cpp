@@ -0,0 +1,167 @@
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "ClusterZI/zidm_psm.h"
+#include "zidm_check.h"
+
+/* The PSM (see zidm_psm.h): the batched counts against a pair-by-pair
+ * count, the packed file read back, the Binder and VI losses of a small
+ * PSM worked out by hand, and point estimates that recover clear clusters.
+ */
+
+struct lcg {
+
+  // Small deterministic generator of the test labels
+  std::uint64_t x;
+  explicit lcg(std::uint64_t seed): x(seed) {}
+  unsigned int operator()(unsigned int m){
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    return static_cast<unsigned int>((x >> 33) % m);
+  }
+
+};
+
+void test_accum(){
+
+  // More samples than a tile and draws that end in a partial batch
+  const unsigned int n = 70, K = 4, n_draws = 150;
+  lcg rng(3);
+  psm_accum a, b;
+  a.init(n, K);
+  b.init(n, K);
+  std::vector<std::uint32_t> brute(psm_offset(n, n), 0);
+  arma::uvec labels(n);
+  for(unsigned int t = 0; t < n_draws; ++t){
+    for(unsigned int i = 0; i < n; ++i){
+      labels[i] = rng(K);
+    }
+    for(unsigned int i = 0; i < n; ++i){
+      for(unsigned int j = i + 1; j < n; ++j){
+        brute[psm_index(n, i, j)] += (labels[i] == labels[j]);
+      }
+    }
+    // The first 100 draws to a, the others to b
+    (t < 100 ? a : b).add(labels);
+  }
+  a.flush();
+  b.flush();
+  CHECK(a.n_draws == 100 and b.n_draws == 50);
+  a.merge(b);
+  CHECK(a.n_draws == n_draws);
+  CHECK(a.count == brute);
+  CHECK(psm_index(n, 5, 9) == psm_index(n, 9, 5));
+  CHECK(psm_index(n, n - 2, n - 1) + 1 == brute.size());
+
+  // The file holds the probabilities in the same order
+  write_psm_bin("psm.bin", a);
+  std::ifstream in("psm.bin", std::ios::binary);
+  psm_file_header header;
+  in.read(reinterpret_cast<char *>(&header), sizeof(header));
+  std::vector<float> prob(brute.size());
+  in.read(reinterpret_cast<char *>(&prob[0]), prob.size() * sizeof(float));
+  CHECK(in.good());
+  CHECK(std::string(header.magic, 6) == "CZIPSM");
+  CHECK(header.version == psm_version);
+  CHECK(header.n_draws == n_draws and header.n == n);
+  CHECK(prob == a.probabilities());
+  CHECK(near(prob[psm_index(n, 2, 7)],
+             brute[psm_index(n, 2, 7)] / double(n_draws), 1e-6));
+
+  CHECK_THROWS(a.init(n, 70000));
+
+}
+
+void test_known_loss(){
+
+  /* n = 3 with p_01 = 0.9, p_02 = 0.1 and p_12 = 0.2. For labels {0, 0, 1}
+   * the Binder loss is (1 - 0.9) + 0.1 + 0.2 = 0.4. For VI, the cluster
+   * sums are s = (1.9, 1.9, 1) and the row sums r = (2, 2.1, 1.3), so the
+   * bound is [(1 - 2 log2 1.9 + log2 2) + (1 - 2 log2 1.9 + log2 2.1) +
+   * (0 - 0 + log2 1.3)] / 3 = 0.2483011 */
+
+  const std::vector<float> prob = {0.9f, 0.1f, 0.2f};
+  const std::vector<unsigned int> labels = {0, 0, 1};
+  CHECK(near(psm_loss(prob, 3, labels, loss_binder), 0.4, 1e-6));
+  CHECK(near(psm_loss(prob, 3, labels, loss_vi), 0.24830109230674524,
+             1e-6));
+  // All together: 0.1 + 0.9 + 0.8; apart: 0.9 + 0.1 + 0.2
+  CHECK(near(psm_loss(prob, 3, {0, 0, 0}, loss_binder), 1.8, 1e-6));
+  CHECK(near(psm_loss(prob, 3, {0, 1, 2}, loss_binder), 1.2, 1e-6));
+
+  // {0, 0, 1} is the best of the five clusterings for both losses, and
+  // the search finds it from one cluster and from singletons
+  for(int loss : {loss_binder, loss_vi}){
+    const double best = psm_loss(prob, 3, labels, loss);
+    for(const std::vector<unsigned int> &other :
+          std::vector<std::vector<unsigned int> >({{0, 0, 0}, {0, 1, 2},
+                                                  {0, 1, 0}, {0, 1, 1}})){
+      CHECK(psm_loss(prob, 3, other, loss) > best);
+    }
+    std::vector<unsigned int> from_one = {0, 0, 0};
+    CHECK(near(psm_search(prob, 3, loss, 3, from_one), best, 1e-9));
+    CHECK(from_one == labels);
+    std::vector<unsigned int> from_apart = {0, 1, 2};
+    CHECK(near(psm_search(prob, 3, loss, 3, from_apart), best, 1e-9));
+    CHECK(from_apart == labels);
+  }
+
+}
+
+void test_point(){
+
+  /* Two blocks of 12 samples, each sample in the wrong block in 10% of the
+   * draws; the point estimate is the two blocks */
+
+  const unsigned int n = 24, n_draws = 200;
+  lcg rng(9);
+  psm_accum psm;
+  psm.init(n, 5);
+  arma::uvec labels(n);
+  for(unsigned int t = 0; t < n_draws; ++t){
+    for(unsigned int i = 0; i < n; ++i){
+      unsigned int block = (i < n / 2) ? 3 : 1;
+      labels[i] = (rng(10) == 0) ? 4 - block : block;
+    }
+    psm.add(labels);
+  }
+  psm.flush();
+
+  std::vector<unsigned int> truth(n);
+  for(unsigned int i = 0; i < n; ++i){
+    truth[i] = (i < n / 2) ? 0 : 1;
+  }
+  arma::uvec one(n), apart(n);
+  for(unsigned int i = 0; i < n; ++i){
+    one[i] = 0;
+    apart[i] = i % 5;
+  }
+  for(int loss : {loss_binder, loss_vi}){
+    CHECK(psm_point(psm, loss, 5, apart) == truth);
+    CHECK(psm_point(psm, loss, 5, labels) == truth);
+  }
+  CHECK(psm_point(psm, loss_binder, 5, one) == truth);
+
+  // From one cluster, moving any single sample out raises the VI bound, so
+  // that start stays put; the start from the labels of the chain finds
+  // the blocks
+  std::vector<float> prob = psm.probabilities();
+  std::vector<unsigned int> stuck(n, 0);
+  double loss_one = psm_search(prob, n, loss_vi, 5, stuck);
+  CHECK(stuck == std::vector<unsigned int>(n, 0));
+  CHECK(psm_loss(prob, n, truth, loss_vi) < loss_one);
+
+  psm_accum empty;
+  empty.init(n, 5);
+  CHECK_THROWS(psm_point(empty, loss_binder, 5, one));
+
+}
+
+int main(){
+  test_accum();
+  test_known_loss();
+  test_point();
+  return check_status("zidm_psm_test");
+}
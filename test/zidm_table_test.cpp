@@ -0,0 +1,165 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "ClusterZI/zidm_table.h"
+#include "zidm_check.h"
+
+/* Count tables (see zidm_table.h): delimited files with and without names,
+ * quoted as by write.csv, by sample or by taxon, and binary files of either
+ * value type read back as written, before and after the prevalence filter;
+ * malformed files are refused.
+ */
+
+void write_text(const std::string &path, const std::string &text){
+  std::ofstream out(path.c_str(), std::ios::binary);
+  out << text;
+}
+
+// The 3 x 4 table of the files below
+const double counts[3][4] = {{0, 5, 1, 0},
+                             {0, 7, 0, 2},
+                             {3, 0, 4, 0}};
+
+bool same_counts(const arma::mat &z, const std::vector<unsigned int> &cols){
+  if(z.n_rows != 3 or z.n_cols != cols.size()){
+    return false;
+  }
+  for(unsigned int i = 0; i < 3; ++i){
+    for(unsigned int j = 0; j < cols.size(); ++j){
+      if(z(i, j) != counts[i][cols[j]]){
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void test_delim(){
+
+  const std::vector<unsigned int> all = {0, 1, 2, 3};
+
+  // As write.csv: quoted names, and a name for the row names column
+  write_text("table.csv",
+             "\"\",\"taxon a\",\"taxon, b\",\"c \"\"x\"\"\",\"d\"\r\n"
+             "\"s1\",0,5,1,0\r\n"
+             "\"s2\",0,7,0,2\r\n"
+             "\r\n"
+             "\"s3\",3,0,4,0\r\n");
+  table_format fmt;
+  count_table csv = read_counts("table.csv", fmt);
+  CHECK(same_counts(csv.z, all));
+  CHECK(csv.samples == std::vector<std::string>({"s1", "s2", "s3"}));
+  CHECK(csv.taxa == std::vector<std::string>({"taxon a", "taxon, b",
+                                              "c \"x\"", "d"}));
+  CHECK(csv.p_file == 4);
+  CHECK(csv.keep == all);
+
+  // A taxon a line, as an OTU table, without a name for the first column
+  write_text("table.tsv",
+             "s1\ts2\ts3\n"
+             "a\t0\t0\t3\n"
+             "b\t5\t7\t0\n"
+             "c\t1\t0\t4\n"
+             "d\t0\t2\t0\n");
+  fmt.taxa_rows = true;
+  count_table tsv = read_counts("table.tsv", fmt);
+  CHECK(same_counts(tsv.z, all));
+  CHECK(tsv.samples == std::vector<std::string>({"s1", "s2", "s3"}));
+  CHECK(tsv.taxa == std::vector<std::string>({"a", "b", "c", "d"}));
+
+  // Taxa in at least half of the samples: b and c
+  fmt.min_prevalence = 0.5;
+  count_table kept = read_counts("table.tsv", fmt);
+  CHECK(same_counts(kept.z, {1, 2}));
+  CHECK(kept.keep == std::vector<unsigned int>({1, 2}));
+  CHECK(kept.taxa == std::vector<std::string>({"b", "c"}));
+  CHECK(kept.p_file == 4);
+
+  // No names
+  write_text("table_plain.csv", "0,5,1,0\n0,7,0,2\n3,0,4,0\n");
+  table_format plain;
+  plain.header = false;
+  plain.row_names = false;
+  count_table bare = read_counts("table_plain.csv", plain);
+  CHECK(same_counts(bare.z, all));
+  CHECK(bare.samples.empty() and bare.taxa.empty());
+
+  // Not counts, ragged lines, a header of another width, no line
+  write_text("table_bad.csv", "0,5,1,0\n0,-7,0,2\n");
+  CHECK_THROWS(read_counts("table_bad.csv", plain));
+  write_text("table_bad.csv", "0,5,1,0\n0,7.5,0,2\n");
+  CHECK_THROWS(read_counts("table_bad.csv", plain));
+  write_text("table_bad.csv", "0,5,1,0\n0,x,0,2\n");
+  CHECK_THROWS(read_counts("table_bad.csv", plain));
+  write_text("table_bad.csv", "0,5,1,0\n0,7,0\n");
+  CHECK_THROWS(read_counts("table_bad.csv", plain));
+  write_text("table_bad.csv", "a,b\n0,5,1,0\n");
+  plain.header = true;
+  CHECK_THROWS(read_counts("table_bad.csv", plain));
+  write_text("table_bad.csv", "\n");
+  CHECK_THROWS(read_counts("table_bad.csv", plain));
+  CHECK_THROWS(read_counts("table_missing.csv", plain));
+  CHECK_THROWS(read_counts("table.xls", plain));
+
+}
+
+void test_bin(){
+
+  const std::vector<unsigned int> all = {0, 1, 2, 3};
+  arma::mat z(3, 4);
+  for(unsigned int i = 0; i < 3; ++i){
+    for(unsigned int j = 0; j < 4; ++j){
+      z(i, j) = counts[i][j];
+    }
+  }
+  write_count_bin("table.bin", z);
+  table_format fmt;
+  count_table bin = read_counts("table.bin", fmt);
+  CHECK(same_counts(bin.z, all));
+  CHECK(bin.samples.empty() and bin.taxa.empty());
+  fmt.min_prevalence = 0.5;
+  count_table kept = read_counts("table.bin", fmt);
+  CHECK(same_counts(kept.z, {1, 2}));
+  CHECK(kept.keep == std::vector<unsigned int>({1, 2}));
+
+  // uint32 values, with the format given instead of the extension
+  count_file_header header;
+  std::memcpy(header.magic, count_magic, 8);
+  header.version = count_version;
+  header.type = count_uint32;
+  header.n = 3;
+  header.p = 4;
+  std::vector<std::uint32_t> values;
+  for(unsigned int j = 0; j < 4; ++j){
+    for(unsigned int i = 0; i < 3; ++i){
+      values.push_back(static_cast<std::uint32_t>(counts[i][j]));
+    }
+  }
+  std::ofstream out("table_u32.dat", std::ios::binary);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(&values[0]),
+            values.size() * sizeof(std::uint32_t));
+  out.close();
+  table_format u32;
+  u32.format = "bin";
+  CHECK(same_counts(read_counts("table_u32.dat", u32).z, all));
+
+  // A cut file and a count that is not one
+  std::ofstream("table_cut.bin", std::ios::binary).write(
+    reinterpret_cast<const char *>(&header), sizeof(header));
+  CHECK_THROWS(read_counts("table_cut.bin", table_format()));
+  z(1, 2) = 0.5;
+  write_count_bin("table_bad.bin", z);
+  CHECK_THROWS(read_counts("table_bad.bin", table_format()));
+
+}
+
+int main(){
+  test_delim();
+  test_bin();
+  return check_status("zidm_table_test");
+}
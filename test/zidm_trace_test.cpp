@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "ClusterZI/zidm_trace.h"
+#include "zidm_check.h"
+
+/* Round trips of the trace codec (see zidm_trace.h): run-length coding of
+ * zero runs and literals at their limits, and traces written by
+ * trace_writer, raw and compressed, read back by trace_reader, also when
+ * the last chunk of the file is cut short.
+ */
+
+void check_rle(const std::vector<unsigned char> &x){
+  std::vector<unsigned char> enc;
+  rle_encode(x.empty() ? NULL : &x[0], x.size(), enc);
+  std::vector<unsigned char> dec(x.size() + 1, 0xff);
+  bool ok = rle_decode(enc.empty() ? NULL : &enc[0], enc.size(), &dec[0],
+                       x.size());
+  CHECK(ok);
+  CHECK(std::equal(x.begin(), x.end(), dec.begin()));
+  // A longer output than encoded is an error
+  if(not x.empty()){
+    CHECK(not rle_decode(&enc[0], enc.size(), &dec[0], x.size() + 1));
+  }
+}
+
+void test_rle(){
+  check_rle(std::vector<unsigned char>());
+  check_rle(std::vector<unsigned char>(1, 0));
+  check_rle(std::vector<unsigned char>(1, 7));
+  // Zero runs of 2, 129 (the longest) and 130 bytes
+  for(std::size_t run : {2, 128, 129, 130, 1000}){
+    std::vector<unsigned char> x(run, 0);
+    x.push_back(3);
+    check_rle(x);
+  }
+  // Literals of 128 (the longest) and more bytes, single zeros among them
+  for(std::size_t len : {127, 128, 129, 300}){
+    std::vector<unsigned char> x(len);
+    for(std::size_t b = 0; b < len; ++b){
+      x[b] = (b % 5 == 0) ? 0 : static_cast<unsigned char>(b);
+    }
+    check_rle(x);
+  }
+  // Mixed
+  std::vector<unsigned char> x;
+  for(unsigned int b = 0; b < 5000; ++b){
+    x.push_back(((b * 2654435761u) >> 7) % 3 == 0 ? (b & 0xff) : 0);
+  }
+  check_rle(x);
+}
+
+struct trace_data {
+
+  /* Records of iteration t: labels, indicators, beta and U */
+
+  trace_dims dims;
+  std::vector<unsigned int> labels;
+  std::vector<unsigned char> bits;
+  std::vector<double> beta;
+
+  explicit trace_data(const trace_dims &d): dims(d), labels(d.n),
+    bits(static_cast<std::size_t>(d.n) * d.p), beta(d.values(trace_beta)) {}
+
+  void fill(unsigned int t){
+    for(unsigned int i = 0; i < dims.n; ++i){
+      labels[i] = (i + t / 3) % dims.K;
+    }
+    for(std::size_t e = 0; e < bits.size(); ++e){
+      bits[e] = ((e * 7 + t / 2) % 5) != 0;
+    }
+    for(std::size_t e = 0; e < beta.size(); ++e){
+      beta[e] = (t % 4 == 0) ? 0.25 * t + e : 0.25 * (t - t % 4) + e;
+    }
+  }
+
+  void put(trace_writer &w, unsigned int t){
+    fill(t);
+    w.put_labels(&labels[0]);
+    w.put_bits(trace_gamma, &bits[0]);
+    w.put_doubles(trace_beta, &beta[0]);
+    w.put_scalar(trace_U, 0.5 * t);
+  }
+
+};
+
+const std::uint32_t test_mask = (1u << trace_assign) | (1u << trace_gamma) |
+  (1u << trace_beta) | (1u << trace_U);
+
+void check_records(const std::string &path, const trace_dims &dims,
+                   unsigned int n_rec){
+
+  /* The file at path holds the records of iterations 0, ..., n_rec - 1 */
+
+  trace_reader reader(path);
+  CHECK(reader.dimensions().n == dims.n);
+  CHECK(reader.dimensions().p == dims.p);
+  CHECK(reader.dimensions().K == dims.K);
+  CHECK(reader.mask() == test_mask);
+  CHECK(not reader.has(trace_tau));
+  for(int id : {trace_assign, trace_gamma, trace_beta, trace_U}){
+    CHECK(reader.records(id) == n_rec);
+  }
+  std::vector<double> labels(n_rec * dims.values(trace_assign));
+  std::vector<double> bits(n_rec * dims.values(trace_gamma));
+  std::vector<double> beta(n_rec * dims.values(trace_beta));
+  std::vector<double> U(n_rec);
+  if(n_rec == 0){
+    return;
+  }
+  reader.read(trace_assign, &labels[0]);
+  reader.read(trace_gamma, &bits[0]);
+  reader.read(trace_beta, &beta[0]);
+  reader.read(trace_U, &U[0]);
+  trace_data rec(dims);
+  bool same = true;
+  for(unsigned int t = 0; t < n_rec; ++t){
+    rec.fill(t);
+    for(unsigned int i = 0; i < dims.n; ++i){
+      same = same and (labels[t * dims.n + i] == rec.labels[i]);
+    }
+    for(std::size_t e = 0; e < rec.bits.size(); ++e){
+      same = same and (bits[t * rec.bits.size() + e] == rec.bits[e]);
+    }
+    for(std::size_t e = 0; e < rec.beta.size(); ++e){
+      same = same and (beta[t * rec.beta.size() + e] == rec.beta[e]);
+    }
+    same = same and (U[t] == 0.5 * t);
+  }
+  CHECK(same);
+
+}
+
+void test_round_trip(bool compress){
+
+  trace_dims dims;
+  dims.n = 23;
+  dims.p = 11;
+  dims.K = 5;
+  const std::string path = compress ? "trace_rle.trc" : "trace_raw.trc";
+  const unsigned int n_rec = 100;
+  {
+    // Small chunks, so that the file has many of them
+    trace_writer writer(path, dims, test_mask, compress, 512);
+    trace_data rec(dims);
+    for(unsigned int t = 0; t < n_rec; ++t){
+      rec.put(writer, t);
+    }
+  }
+  check_records(path, dims, n_rec);
+
+  // Cut the last chunk short: the reader keeps the complete chunks
+  std::ifstream in(path.c_str(), std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+  in.close();
+  trace_reader full(path);
+  std::size_t cut = bytes.size() - 3;
+  std::ofstream out("trace_cut.trc", std::ios::binary);
+  out.write(&bytes[0], cut);
+  out.close();
+  trace_reader part("trace_cut.trc");
+  CHECK(part.indexed_bytes() < cut);
+  std::size_t n_kept = n_rec;
+  for(int id : {trace_assign, trace_gamma, trace_beta, trace_U}){
+    n_kept = std::min(n_kept, part.records(id));
+    CHECK(part.records(id) <= full.records(id));
+  }
+  CHECK(n_kept < n_rec);
+
+}
+
+void test_resume(){
+
+  /* A file continued from a position matches a file written in one go,
+   * also when records were written after the position */
+
+  trace_dims dims;
+  dims.n = 17;
+  dims.p = 6;
+  dims.K = 4;
+  trace_data rec(dims);
+  trace_position pos;
+  {
+    trace_writer writer("trace_resume.trc", dims, test_mask, true, 256);
+    for(unsigned int t = 0; t < 30; ++t){
+      rec.put(writer, t);
+    }
+    pos = writer.position();
+    for(unsigned int t = 30; t < 37; ++t){
+      rec.put(writer, t);
+    }
+  }
+  CHECK(pos.records == 30);
+  {
+    trace_writer writer("trace_resume.trc", dims, test_mask, true, pos, 256);
+    for(unsigned int t = 30; t < 60; ++t){
+      rec.put(writer, t);
+    }
+  }
+  check_records("trace_resume.trc", dims, 60);
+
+  // No file: a new one; a file the position does not describe: an error
+  std::remove("trace_new.trc");
+  {
+    trace_writer writer("trace_new.trc", dims, test_mask, true, pos);
+    for(unsigned int t = 0; t < 5; ++t){
+      rec.put(writer, t);
+    }
+  }
+  check_records("trace_new.trc", dims, 5);
+  CHECK_THROWS(trace_writer("trace_new.trc", dims, test_mask, true,
+                            trace_position()));
+  CHECK_THROWS(trace_writer("trace_new.trc", dims, test_mask, true, pos));
+  CHECK_THROWS(trace_writer("trace_resume.trc", dims,
+                            1u << trace_assign, true, pos));
+  check_records("trace_new.trc", dims, 5);
+
+}
+
+int main(){
+  test_rle();
+  test_round_trip(false);
+  test_round_trip(true);
+  test_resume();
+  return check_status("zidm_trace_test");
+}